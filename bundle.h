@@ -0,0 +1,25 @@
+#include <stdint.h>
+
+/*
+ * the `--bundle` format, written by mkbundle
+ *
+ * a `struct BundleHeader`, the contents of the members one after another,
+ * then at `index`, a multiple of `BUNDLE_ALIGN`, a `struct BundleEntry`
+ * per member, then their names, all in host byte order
+ * */
+
+#define BUNDLE_MAGIC "lexbndl1"
+#define BUNDLE_ALIGN 8
+
+struct BundleHeader {
+  char magic[8];
+  uint64_t n;
+  uint64_t index;
+};
+
+struct BundleEntry {
+  uint64_t offset;
+  uint64_t len;
+  uint32_t name;       // from the start of the names
+  uint32_t name_len;
+};
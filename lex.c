@@ -1,14 +1,80 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include <stdint.h>
+#include <limits.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <zlib.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __x86_64__
+#include <wmmintrin.h>
+#endif
+
+#include "punct.h"
+#include "bundle.h"
+#include "tokring.h"
+#include "tokstream.h"
 
 #define NTYPES 8
 #define BUF_SIZE 0x100
 #define OTHER(x) (~x & 1u)
 #define NELEMS(a) (sizeof(a) / sizeof(a[0]))
 #define LOWER(c) (c | 32)
-#define IS_OCT_DIGIT(c) ((c | 0x07) == '7')
+#define PAD 64
+
+/*
+ * char classes, one byte of flags per char
+ * they do not depend on the locale and take any `char`, negative or not
+ * */
+#define CC_IDENT_START 0x01
+#define CC_IDENT 0x02
+#define CC_DIGIT 0x04
+#define CC_OCT 0x08
+#define CC_HEX 0x10
+#define CC_SPACE 0x20
+
+static const unsigned char char_class[256] = {
+  [' '] = CC_SPACE, ['\t'] = CC_SPACE, ['\n'] = CC_SPACE,
+  ['0' ... '7'] = CC_IDENT | CC_DIGIT | CC_OCT | CC_HEX,
+  ['8' ... '9'] = CC_IDENT | CC_DIGIT | CC_HEX,
+  ['A' ... 'F'] = CC_IDENT_START | CC_IDENT | CC_HEX,
+  ['G' ... 'Z'] = CC_IDENT_START | CC_IDENT,
+  ['a' ... 'f'] = CC_IDENT_START | CC_IDENT | CC_HEX,
+  ['g' ... 'z'] = CC_IDENT_START | CC_IDENT,
+  ['_'] = CC_IDENT_START | CC_IDENT
+};
+
+#define CLASS(c) char_class[(unsigned char)(c)]
+#define IS_IDENT_START(c) (CLASS(c) & CC_IDENT_START)
+#define IS_IDENT(c) (CLASS(c) & CC_IDENT)
+#define IS_DIGIT(c) (CLASS(c) & CC_DIGIT)
+#define IS_OCT_DIGIT(c) (CLASS(c) & CC_OCT)
+#define IS_HEX_DIGIT(c) (CLASS(c) & CC_HEX)
+#define IS_SPACE(c) (CLASS(c) & CC_SPACE)
 
 typedef enum {
   FALSE,
@@ -21,6 +87,31 @@ enum ParseResult {
   PARSE_INCOMPLETE
 };
 
+/*
+ * what the recognizers keep between the chars of a token
+ * each run of the `parse()` loop has its own, so lexers can run side by side
+ * */
+struct Utf8Ident {
+  enum ParseResult state;
+  boolean first;
+  int need;
+  unsigned cp;
+  unsigned min;
+};
+
+struct ParseState {
+  struct TrieNode* keyword;
+  enum ParseResult identifier;
+  struct Utf8Ident utf8_ident;
+  unsigned char punct;
+  int charcon;
+  int string;
+  int integer;
+  int floating;
+  int error;
+  int comment;
+};
+
 struct TrieNode {
   struct TrieNode* child;
   struct TrieNode* next;
@@ -55,36 +146,53 @@ void insert(struct TrieNode* trie, const char* s) {
   p->flag = PARSE_SUCCESS;
 }
 
-enum ParseResult keyword_parser(char c, boolean rst) {
-
-  static boolean first_call = TRUE;
-  static struct TrieNode* trie;
+static const char* keywords[32] = {
+  "auto", "double", "int", "struct", "break", "else", "static", "long",
+  "switch", "case", "enum", "register", "typedef", "char", "extern", "return",
+  "union", "const", "float", "short", "unsigned", "continue", "for", "signed",
+  "void", "default", "goto", "sizeof", "volatile", "do", "if", "while"
+};
 
-  if (first_call) {
-    trie = (struct TrieNode*)malloc(sizeof(struct TrieNode));
-    trie->child = NULL;
-    trie->next = NULL;
-    trie->flag = PARSE_INCOMPLETE;
-    trie->c = '\0';
+#define KEYWORD_MAX_LEN 8
 
-    const char* keywords[32] = {
-      "auto", "double", "int", "struct", "break", "else", "static", "long",
-      "switch", "case", "enum", "register", "typedef", "char", "extern", "return",
-      "union", "const", "float", "short", "unsigned", "continue", "for", "signed",
-      "void", "default", "goto", "sizeof", "volatile", "do", "if", "while"
-    };
+/*
+ * if `s` is one of `keywords`, return `1`
+ * else return `0`
+ * */
+boolean is_keyword(const char* s) {
 
-    for (int i = 0; i < NELEMS(keywords); i++) {
-      insert(trie, keywords[i]);
+  for (int i = 0; i < NELEMS(keywords); i++) {
+    if (strcmp(s, keywords[i]) == 0) {
+      return TRUE;
     }
+  }
+
+  return FALSE;
+}
+
+static struct TrieNode* keyword_trie;
+static pthread_once_t keyword_once = PTHREAD_ONCE_INIT;
 
-    first_call = FALSE;
+void keyword_init(void) {
+
+  keyword_trie = (struct TrieNode*)malloc(sizeof(struct TrieNode));
+  keyword_trie->child = NULL;
+  keyword_trie->next = NULL;
+  keyword_trie->flag = PARSE_INCOMPLETE;
+  keyword_trie->c = '\0';
+
+  for (int i = 0; i < NELEMS(keywords); i++) {
+    insert(keyword_trie, keywords[i]);
   }
+}
+
+enum ParseResult keyword_parser(char c, boolean rst, struct ParseState* ps) {
 
-  static struct TrieNode* now = NULL;
+  struct TrieNode* now = ps->keyword;
 
   if (rst) {
-    now = trie;
+    pthread_once(&keyword_once, keyword_init);
+    now = keyword_trie;
   }
   else if (now == NULL) {
     return PARSE_END;
@@ -95,22 +203,19 @@ enum ParseResult keyword_parser(char c, boolean rst) {
       break;
     }
   }
+  ps->keyword = now;
 
   return now == NULL ? PARSE_END : now->flag;
 }
 
-enum ParseResult identifier_parser(char c, boolean rst) {
+enum ParseResult identifier_parser(char c, boolean rst, struct ParseState* ps) {
 
-  static enum ParseResult state;
-
-  if (rst) {
-    state = PARSE_INCOMPLETE;
-  }
+  enum ParseResult state = rst ? PARSE_INCOMPLETE : ps->identifier;
 
   switch (state) {
 
     case PARSE_INCOMPLETE:
-      if (isalpha(c) || c == '_') {
+      if (IS_IDENT_START(c)) {
         state = PARSE_SUCCESS;
       }
       else {
@@ -119,7 +224,7 @@ enum ParseResult identifier_parser(char c, boolean rst) {
       break;
 
     case PARSE_SUCCESS:
-      if (isalnum(c) || c == '_') {
+      if (IS_IDENT(c)) {
         state = PARSE_SUCCESS;
       }
       else {
@@ -128,79 +233,180 @@ enum ParseResult identifier_parser(char c, boolean rst) {
       break;
   }
 
+  ps->identifier = state;
+
   return state;
 }
 
-enum ParseResult operator_parser(char c, boolean rst) {
-
-  static boolean first_call = TRUE;
-  static struct TrieNode* trie;
-
-  if (first_call) {
-    trie = (struct TrieNode*)malloc(sizeof(struct TrieNode));
-    trie->child = NULL;
-    trie->next = NULL;
-    trie->flag = PARSE_INCOMPLETE;
-    trie->c = '\0';
+/*
+ * C11 Annex D: ranges of characters allowed in identifiers
+ * */
+static const unsigned ident_ranges[][2] = {
+  { 0x00A8, 0x00A8 }, { 0x00AA, 0x00AA }, { 0x00AD, 0x00AD }, { 0x00AF, 0x00AF },
+  { 0x00B2, 0x00B5 }, { 0x00B7, 0x00BA }, { 0x00BC, 0x00BE }, { 0x00C0, 0x00D6 },
+  { 0x00D8, 0x00F6 }, { 0x00F8, 0x00FF }, { 0x0100, 0x167F }, { 0x1681, 0x180D },
+  { 0x180F, 0x1FFF }, { 0x200B, 0x200D }, { 0x202A, 0x202E }, { 0x203F, 0x2040 },
+  { 0x2054, 0x2054 }, { 0x2060, 0x206F }, { 0x2070, 0x218F }, { 0x2460, 0x24FF },
+  { 0x2776, 0x2793 }, { 0x2C00, 0x2DFF }, { 0x2E80, 0x2FFF }, { 0x3004, 0x3007 },
+  { 0x3021, 0x302F }, { 0x3031, 0x303F }, { 0x3040, 0xD7FF }, { 0xF900, 0xFD3D },
+  { 0xFD40, 0xFDCF }, { 0xFDF0, 0xFE44 }, { 0xFE47, 0xFFFD }
+};
 
-    const char* operators[35] = {
-      "+", "-", "*", "/", "%", "++", "--",
-      "==", "!=", ">", "<", ">=", "<=",
-      "&&", "||", "!",
-      "&", "|", "^", "~", "<<", ">>",
-      "=", "+=", "-=", "*=", "/=", "%=", "<<=", ">>=", "&=", "^=", "|=",
-      ".", "->"
-    };
+/*
+ * C11 Annex D: ranges of characters disallowed initially
+ * */
+static const unsigned ident_initial_ranges[][2] = {
+  { 0x0300, 0x036F }, { 0x1DC0, 0x1DFF }, { 0x20D0, 0x20FF }, { 0xFE20, 0xFE2F }
+};
 
-    for (int i = 0; i < NELEMS(operators); i++) {
-      insert(trie, operators[i]);
+boolean in_ranges(unsigned cp, const unsigned (*r)[2], int n) {
+  for (int i = 0; i < n; i++) {
+    if (cp >= r[i][0] && cp <= r[i][1]) {
+      return TRUE;
     }
+  }
+  return FALSE;
+}
 
-    first_call = FALSE;
+boolean is_ident_char(unsigned cp, boolean first) {
+  if (cp >= 0x10000) {
+    // every plane but the last, except its two noncharacters
+    return cp <= 0xEFFFD && (cp & 0xFFFF) <= 0xFFFD;
+  }
+  if (first && in_ranges(cp, ident_initial_ranges, NELEMS(ident_initial_ranges))) {
+    return FALSE;
   }
+  return in_ranges(cp, ident_ranges, NELEMS(ident_ranges));
+}
+
+/*
+ * identifier_parser, also taking UTF-8 encoded extended characters
+ * */
+enum ParseResult utf8_identifier_parser(char c, boolean rst, struct ParseState* ps) {
 
-  static struct TrieNode* now = NULL;
+  struct Utf8Ident* st = &ps->utf8_ident;
 
   if (rst) {
-    now = trie;
+    st->state = PARSE_INCOMPLETE;
+    st->first = TRUE;
+    st->need = 0;
   }
-  else if (now == NULL) {
-    return PARSE_END;
+
+  if (st->state == PARSE_END) {
+    return st->state;
   }
 
-  for (now = now->child; now != NULL; now = now->next) {
-    if (c == now->c) {
-      break;
+  unsigned char u = c;
+
+  if (st->need > 0) {
+    if ((u & 0xC0) != 0x80) {
+      st->state = PARSE_END;
+      return st->state;
+    }
+
+    st->cp = st->cp << 6 | (u & 0x3F);
+
+    if (--st->need > 0) {
+      return PARSE_INCOMPLETE;
+    }
+
+    if (st->cp < st->min || (st->cp >= 0xD800 && st->cp <= 0xDFFF) || !is_ident_char(st->cp, st->first)) {
+      st->state = PARSE_END;
     }
+    else {
+      st->state = PARSE_SUCCESS;
+      st->first = FALSE;
+    }
+    return st->state;
   }
 
-  return now == NULL ? PARSE_END : now->flag;
+  if (u < 0x80) {
+    if (IS_IDENT_START(c) || (!st->first && IS_DIGIT(c))) {
+      st->state = PARSE_SUCCESS;
+      st->first = FALSE;
+    }
+    else {
+      st->state = PARSE_END;
+    }
+    return st->state;
+  }
+
+  if (u >= 0xC2 && u <= 0xDF) {
+    st->need = 1, st->cp = u & 0x1F, st->min = 0x80;
+  }
+  else if (u >= 0xE0 && u <= 0xEF) {
+    st->need = 2, st->cp = u & 0x0F, st->min = 0x800;
+  }
+  else if (u >= 0xF0 && u <= 0xF4) {
+    st->need = 3, st->cp = u & 0x07, st->min = 0x10000;
+  }
+  else {
+    st->state = PARSE_END;
+    return st->state;
+  }
+
+  return PARSE_INCOMPLETE;
+}
+
+enum ParseResult operator_parser(char c, boolean rst, struct ParseState* ps) {
+
+  unsigned char state = punct_next[rst ? PUNCT_START : ps->punct][(unsigned char)c];
+
+  ps->punct = state;
+
+  if (punct_accept[state] == PUNCT_OPERATOR) {
+    return PARSE_SUCCESS;
+  } else if (state != PUNCT_DEAD && punct_accept[state] == PUNCT_NONE) {
+    return PARSE_INCOMPLETE;
+  } else {
+    return PARSE_END;
+  }
 }
 
-enum ParseResult delimiter_parser(char c, boolean rst) {
+enum ParseResult delimiter_parser(char c, boolean rst, struct ParseState* ps) {
+
+  (void)ps;             // a delimiter is one char, nothing is kept
 
   if (rst == FALSE) {
     return PARSE_END;
   }
 
-  static const char delimiters[10] = {
-    ';', ',', ':', '?',
-    '(', ')', '[', ']',
-    '{', '}'
-  };
+  if (punct_accept[punct_next[PUNCT_START][(unsigned char)c]] == PUNCT_DELIMITER) {
+    return PARSE_SUCCESS;
+  }
+
+  return PARSE_END;
+}
+
+/*
+ * longest operator or delimiter at `s`, at most `PUNCT_MAX_LEN` chars
+ * return its length and leave its `PunctAccept` in `*accept`
+ * */
+int punct_match(const char* s, int* accept) {
+
+  unsigned char state = PUNCT_START;
+  int len = 0;
+
+  *accept = PUNCT_NONE;
+
+  for (int i = 0; i < PUNCT_MAX_LEN; i++) {
+    state = punct_next[state][(unsigned char)s[i]];
 
-  for (int i = 0; i < NELEMS(delimiters); i++) {
-    if (c == delimiters[i]) {
-      return PARSE_SUCCESS;
+    if (state == PUNCT_DEAD) {
+      break;
+    }
+    if (punct_accept[state] != PUNCT_NONE) {
+      *accept = punct_accept[state];
+      len = i + 1;
     }
   }
 
-  return PARSE_END;
+  return len;
 }
 
-enum ParseResult charcon_parser(char c, boolean rst) {
+enum ParseResult charcon_parser(char c, boolean rst, struct ParseState* ps) {
 
-  static enum {
+  enum {
     START,
     WIDE,
     EMPTY,
@@ -217,11 +423,7 @@ enum ParseResult charcon_parser(char c, boolean rst) {
     U1,
     ACCEPT,
     ERROR
-  } state;
-
-  if (rst) {
-    state = START;
-  }
+  } state = rst ? START : ps->charcon;
 
   switch (state) {
 
@@ -295,7 +497,7 @@ enum ParseResult charcon_parser(char c, boolean rst) {
       break;
 
     case U8:
-      if (isxdigit(c)) {
+      if (IS_HEX_DIGIT(c)) {
         state = U7;
       }
       else {
@@ -304,7 +506,7 @@ enum ParseResult charcon_parser(char c, boolean rst) {
       break;
 
     case U7:
-      if (isxdigit(c)) {
+      if (IS_HEX_DIGIT(c)) {
         state = U6;
       }
       else {
@@ -313,7 +515,7 @@ enum ParseResult charcon_parser(char c, boolean rst) {
       break;
 
     case U6:
-      if (isxdigit(c)) {
+      if (IS_HEX_DIGIT(c)) {
         state = U5;
       }
       else {
@@ -322,7 +524,7 @@ enum ParseResult charcon_parser(char c, boolean rst) {
       break;
 
     case U5:
-      if (isxdigit(c)) {
+      if (IS_HEX_DIGIT(c)) {
         state = U4;
       }
       else {
@@ -331,7 +533,7 @@ enum ParseResult charcon_parser(char c, boolean rst) {
       break;
 
     case U4:
-      if (isxdigit(c)) {
+      if (IS_HEX_DIGIT(c)) {
         state = U3;
       }
       else {
@@ -340,7 +542,7 @@ enum ParseResult charcon_parser(char c, boolean rst) {
       break;
 
     case U3:
-      if (isxdigit(c)) {
+      if (IS_HEX_DIGIT(c)) {
         state = U2;
       }
       else {
@@ -349,7 +551,7 @@ enum ParseResult charcon_parser(char c, boolean rst) {
       break;
 
     case U2:
-      if (isxdigit(c)) {
+      if (IS_HEX_DIGIT(c)) {
         state = U1;
       }
       else {
@@ -358,7 +560,7 @@ enum ParseResult charcon_parser(char c, boolean rst) {
       break;
 
     case U1:
-      if (isxdigit(c)) {
+      if (IS_HEX_DIGIT(c)) {
         state = WAIT;
       }
       else {
@@ -366,6 +568,7 @@ enum ParseResult charcon_parser(char c, boolean rst) {
       }
       break;
   }
+  ps->charcon = state;
 
   if (state == ERROR) {
     return PARSE_END;
@@ -376,9 +579,9 @@ enum ParseResult charcon_parser(char c, boolean rst) {
   }
 }
 
-enum ParseResult string_parser(char c, boolean rst) {
+enum ParseResult string_parser(char c, boolean rst, struct ParseState* ps) {
 
-  static enum {
+  enum {
     START,
     UPPER_PREF,
     LOWER_PREF,
@@ -395,11 +598,7 @@ enum ParseResult string_parser(char c, boolean rst) {
     U1,
     ACCEPT,
     ERROR
-  } state;
-
-  if (rst) {
-    state = START;
-  }
+  } state = rst ? START : ps->string;
 
   switch (state) {
 
@@ -476,7 +675,7 @@ enum ParseResult string_parser(char c, boolean rst) {
       break;
 
     case U8:
-      if (isxdigit(c)) {
+      if (IS_HEX_DIGIT(c)) {
         state = U7;
       }
       else {
@@ -485,7 +684,7 @@ enum ParseResult string_parser(char c, boolean rst) {
       break;
 
     case U7:
-      if (isxdigit(c)) {
+      if (IS_HEX_DIGIT(c)) {
         state = U6;
       }
       else {
@@ -494,7 +693,7 @@ enum ParseResult string_parser(char c, boolean rst) {
       break;
 
     case U6:
-      if (isxdigit(c)) {
+      if (IS_HEX_DIGIT(c)) {
         state = U5;
       }
       else {
@@ -503,7 +702,7 @@ enum ParseResult string_parser(char c, boolean rst) {
       break;
 
     case U5:
-      if (isxdigit(c)) {
+      if (IS_HEX_DIGIT(c)) {
         state = U4;
       }
       else {
@@ -512,7 +711,7 @@ enum ParseResult string_parser(char c, boolean rst) {
       break;
 
     case U4:
-      if (isxdigit(c)) {
+      if (IS_HEX_DIGIT(c)) {
         state = U3;
       }
       else {
@@ -521,7 +720,7 @@ enum ParseResult string_parser(char c, boolean rst) {
       break;
 
     case U3:
-      if (isxdigit(c)) {
+      if (IS_HEX_DIGIT(c)) {
         state = U2;
       }
       else {
@@ -530,7 +729,7 @@ enum ParseResult string_parser(char c, boolean rst) {
       break;
 
     case U2:
-      if (isxdigit(c)) {
+      if (IS_HEX_DIGIT(c)) {
         state = U1;
       }
       else {
@@ -539,7 +738,7 @@ enum ParseResult string_parser(char c, boolean rst) {
       break;
 
     case U1:
-      if (isxdigit(c)) {
+      if (IS_HEX_DIGIT(c)) {
         state = WAIT;
       }
       else {
@@ -547,6 +746,7 @@ enum ParseResult string_parser(char c, boolean rst) {
       }
       break;
   }
+  ps->string = state;
 
   if (state == ERROR) {
     return PARSE_END;
@@ -557,9 +757,9 @@ enum ParseResult string_parser(char c, boolean rst) {
   }
 }
 
-enum ParseResult integer_parser(char c, boolean rst) {
+enum ParseResult integer_parser(char c, boolean rst, struct ParseState* ps) {
 
-  static enum {
+  enum {
     START,
     ZERO,
     DEC,
@@ -572,11 +772,7 @@ enum ParseResult integer_parser(char c, boolean rst) {
     XUL,
     XSUF,
     ERROR
-  } state;
-
-  if (rst) {
-    state = START;
-  }
+  } state = rst ? START : ps->integer;
 
   switch (state) {
 
@@ -584,7 +780,7 @@ enum ParseResult integer_parser(char c, boolean rst) {
       if (c == '0') {
         state = ZERO;
       }
-      else if (isdigit(c)) {
+      else if (IS_DIGIT(c)) {
         state = DEC;
       }
       else {
@@ -617,7 +813,7 @@ enum ParseResult integer_parser(char c, boolean rst) {
       else if (LOWER(c) == 'u') {
         state = XU;
       }
-      else if (!isdigit(c)) {
+      else if (!IS_DIGIT(c)) {
         state = ERROR;
       }
       break;
@@ -635,7 +831,7 @@ enum ParseResult integer_parser(char c, boolean rst) {
       break;
 
     case ZEROX:
-      if (isxdigit(c)) {
+      if (IS_HEX_DIGIT(c)) {
         state = HEX;
       }
       else {
@@ -650,7 +846,7 @@ enum ParseResult integer_parser(char c, boolean rst) {
       else if (LOWER(c) == 'u') {
         state = XU;
       }
-      else if (!isxdigit(c)) {
+      else if (!IS_HEX_DIGIT(c)) {
         state = ERROR;
       }
       break;
@@ -698,6 +894,7 @@ enum ParseResult integer_parser(char c, boolean rst) {
       state = ERROR;
       break;
   }
+  ps->integer = state;
 
   if (state == ERROR) {
     return PARSE_END;
@@ -708,9 +905,9 @@ enum ParseResult integer_parser(char c, boolean rst) {
   }
 }
 
-enum ParseResult floating_parser(char c, boolean rst) {
+enum ParseResult floating_parser(char c, boolean rst, struct ParseState* ps) {
 
-  static enum {
+  enum {
     START,
     ZERO,
     DEC,
@@ -725,11 +922,7 @@ enum ParseResult floating_parser(char c, boolean rst) {
     EDEC,
     FSUF,
     ERROR
-  } state;
-
-  if (rst) {
-    state = START;
-  }
+  } state = rst ? START : ps->floating;
 
   switch (state) {
 
@@ -737,7 +930,7 @@ enum ParseResult floating_parser(char c, boolean rst) {
       if (c == '0') {
         state = ZERO;
       }
-      else if (isdigit(c)) {
+      else if (IS_DIGIT(c)) {
         state = DEC;
       }
       else if (c == '.') {
@@ -749,7 +942,7 @@ enum ParseResult floating_parser(char c, boolean rst) {
       break;
 
     case ZERO:
-      if (isdigit(c)) {
+      if (IS_DIGIT(c)) {
         state = DEC;
       }
       else if (c == '.') {
@@ -773,13 +966,13 @@ enum ParseResult floating_parser(char c, boolean rst) {
       else if (LOWER(c) == 'e') {
         state = EXP;
       }
-      else if (!isdigit(c)) {
+      else if (!IS_DIGIT(c)) {
         state = ERROR;
       }
       break;
 
     case DDOT:
-      if (isdigit(c)) {
+      if (IS_DIGIT(c)) {
         state = FDEC;
       }
       else {
@@ -794,13 +987,13 @@ enum ParseResult floating_parser(char c, boolean rst) {
       else if (LOWER(c) == 'f' || LOWER(c) == 'l') {
         state = FSUF;
       }
-      else if (!isdigit(c)) {
+      else if (!IS_DIGIT(c)) {
         state = ERROR;
       }
       break;
 
     case ZEROX:
-      if (isxdigit(c)) {
+      if (IS_HEX_DIGIT(c)) {
         state = HEX;
       }
       else if (c == '.') {
@@ -821,7 +1014,7 @@ enum ParseResult floating_parser(char c, boolean rst) {
       break;
 
     case HDOT:
-      if (isxdigit(c)) {
+      if (IS_HEX_DIGIT(c)) {
         state = FHEX;
       }
       else {
@@ -833,7 +1026,7 @@ enum ParseResult floating_parser(char c, boolean rst) {
       if (LOWER(c) == 'p') {
         state = EXP;
       }
-      else if (!isxdigit(c)) {
+      else if (!IS_HEX_DIGIT(c)) {
         state = ERROR;
       }
       break;
@@ -842,7 +1035,7 @@ enum ParseResult floating_parser(char c, boolean rst) {
       if (c == '+' || c == '-') {
         state = SIGN;
       }
-      else if (isdigit(c)) {
+      else if (IS_DIGIT(c)) {
         state = EDEC;
       }
       else {
@@ -851,7 +1044,7 @@ enum ParseResult floating_parser(char c, boolean rst) {
       break;
 
     case SIGN:
-      if (isdigit(c)) {
+      if (IS_DIGIT(c)) {
         state = EDEC;
       }
       else {
@@ -863,7 +1056,7 @@ enum ParseResult floating_parser(char c, boolean rst) {
       if (LOWER(c) == 'f' || LOWER(c) == 'l') {
         state = FSUF;
       }
-      else if (!isdigit(c)) {
+      else if (!IS_DIGIT(c)) {
         state = ERROR;
       }
       break;
@@ -872,6 +1065,7 @@ enum ParseResult floating_parser(char c, boolean rst) {
       state = ERROR;
       break;
   }
+  ps->floating = state;
 
   if (state == ERROR) {
     return PARSE_END;
@@ -882,10 +1076,10 @@ enum ParseResult floating_parser(char c, boolean rst) {
   }
 }
 
-enum ParseResult number_parser(char c, boolean rst) {
+enum ParseResult number_parser(char c, boolean rst, struct ParseState* ps) {
 
-  enum ParseResult res_int = integer_parser(c, rst);
-  enum ParseResult res_float = floating_parser(c, rst);
+  enum ParseResult res_int = integer_parser(c, rst, ps);
+  enum ParseResult res_float = floating_parser(c, rst, ps);
 
   if (res_int == PARSE_SUCCESS || res_float == PARSE_SUCCESS) {
     return PARSE_SUCCESS;
@@ -896,9 +1090,9 @@ enum ParseResult number_parser(char c, boolean rst) {
   }
 }
 
-enum ParseResult error_parser(char c, boolean rst) {
+enum ParseResult error_parser(char c, boolean rst, struct ParseState* ps) {
 
-  static enum {
+  enum {
     START,
     BAD_CHAR,
     BAD_CHARCON,
@@ -911,11 +1105,7 @@ enum ParseResult error_parser(char c, boolean rst) {
     STR_ESCAPE,
     STR_PREF,
     ERROR
-  } state;
-
-  if (rst) {
-    state = START;
-  }
+  } state = rst ? START : ps->error;
 
   switch (state) {
 
@@ -926,7 +1116,7 @@ enum ParseResult error_parser(char c, boolean rst) {
       else if (c == '\"') {
         state = BAD_STRING;
       }
-      else if (isdigit(c)) {
+      else if (IS_DIGIT(c)) {
         state = NUM_PREF;
       }
       else if (c == 'L' || c == 'U') {
@@ -935,7 +1125,7 @@ enum ParseResult error_parser(char c, boolean rst) {
       else if (c == 'u') {
         state = LOWER_PREF;
       }
-      else if (c != ' ' && c != '\n' && c != '\t' && c != EOF) {
+      else if (!IS_SPACE(c)) {
         state = BAD_CHAR;
       }
       else {
@@ -972,16 +1162,16 @@ enum ParseResult error_parser(char c, boolean rst) {
       break;
 
     case NUM_PREF:
-      if (isalpha(c) || c == '_') {
+      if (IS_IDENT_START(c)) {
         state = BAD_IDENTIFIER;
       }
-      else if (!isdigit(c)) {
+      else if (!IS_DIGIT(c)) {
         state = ERROR;
       }
       break;
 
     case BAD_IDENTIFIER:
-      if (!(isalnum(c) || c == '_')) {
+      if (!(IS_IDENT(c))) {
         state = ERROR;
       }
       break;
@@ -1030,6 +1220,7 @@ enum ParseResult error_parser(char c, boolean rst) {
       }
       break;
   }
+  ps->error = state;
 
   if (state == ERROR) {
     return PARSE_END;
@@ -1040,9 +1231,9 @@ enum ParseResult error_parser(char c, boolean rst) {
   }
 }
 
-enum ParseResult comment_parser(char c, boolean rst) {
+enum ParseResult comment_parser(char c, boolean rst, struct ParseState* ps) {
 
-  static enum {
+  enum {
     START,
     SLASH,
     SINGLE,
@@ -1050,11 +1241,7 @@ enum ParseResult comment_parser(char c, boolean rst) {
     STAR,
     END,
     ERROR
-  } state;
-
-  if (rst) {
-    state = START;
-  }
+  } state = rst ? START : ps->comment;
 
   switch (state) {
 
@@ -1104,6 +1291,7 @@ enum ParseResult comment_parser(char c, boolean rst) {
       state = ERROR;
       break;
   }
+  ps->comment = state;
 
   if (state == ERROR) {
     return PARSE_END;
@@ -1114,16 +1302,15 @@ enum ParseResult comment_parser(char c, boolean rst) {
   }
 }
 
-typedef enum ParseResult (*TokenParser)(char, boolean);
-
-enum ParseResult token_parser(char c, boolean rst, int i) {
+typedef enum ParseResult (*TokenParser)(char, boolean, struct ParseState*);
 
-  static const TokenParser parser[NTYPES + 1] = {
-    keyword_parser, identifier_parser, operator_parser, delimiter_parser,
-    charcon_parser, string_parser, number_parser, error_parser, comment_parser
-  };
+static TokenParser parser[NTYPES + 1] = {
+  keyword_parser, identifier_parser, operator_parser, delimiter_parser,
+  charcon_parser, string_parser, number_parser, error_parser, comment_parser
+};
 
-  return parser[i](c, rst);
+enum ParseResult token_parser(char c, boolean rst, int i, struct ParseState* ps) {
+  return parser[i](c, rst, ps);
 }
 
 const char* token_name(int i) {
@@ -1136,6 +1323,21 @@ const char* token_name(int i) {
   return name[i];
 }
 
+/*
+ * if `name` is not a token name, return -1
+ * else return its index, as in `token_name()`
+ * */
+int token_type(const char* name, int len) {
+
+  for (int i = 0; i < NTYPES; i++) {
+    if (strncmp(name, token_name(i), len) == 0 && token_name(i)[len] == '\0') {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
 /*
  * let `arr` be all `val`
  * */
@@ -1179,19 +1381,187 @@ int max_idx(int* arr, int len) {
   return idx;
 }
 
-void parse(char c, boolean rst, enum ParseResult* rv, int len) {
+/*
+ * parsers whose bit is clear in `mask` are never run
+ * */
+void parse(char c, boolean rst, enum ParseResult* rv, int len, unsigned mask, struct ParseState* ps) {
   for (int i = 0; i < len; i++) {
-    if (rst == TRUE || rv[i] != PARSE_END) {
-      rv[i] = token_parser(c, rst, i);
+    if (rst == TRUE && !(mask >> i & 1u)) {
+      rv[i] = PARSE_END;
+    }
+    else if (rst == TRUE || rv[i] != PARSE_END) {
+      rv[i] = token_parser(c, rst, i, ps);
+    }
+  }
+}
+
+/*
+ * `need` more chars to end the sequence, of which `have` are read
+ * */
+struct Utf8State {
+  int need;
+  int have;
+  unsigned char lo;
+  unsigned char hi;
+};
+
+/*
+ * check that `n` chars at `s` continue valid UTF-8 from `st`
+ * if not, return the index of the first bad char, else return -1
+ * blocks of 16 ASCII chars are passed over with one test
+ * */
+long utf8_check(const char* s, long n, struct Utf8State* st) {
+
+  for (long i = 0; i < n; ) {
+#ifdef __SSE2__
+    if (st->need == 0 && n - i >= 16
+      && _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(s + i))) == 0) {
+      i += 16;
+      continue;
+    }
+#endif
+    unsigned char u = s[i++];
+
+    if (st->need > 0) {
+      if (u < st->lo || u > st->hi) {
+        return i - 1;
+      }
+      st->need--;
+      st->have++;
+      st->lo = 0x80;
+      st->hi = 0xBF;
+    }
+    else if (u >= 0x80) {
+      st->have = 1;
+      st->lo = 0x80;
+      st->hi = 0xBF;
+
+      if (u >= 0xC2 && u <= 0xDF) {
+        st->need = 1;
+      }
+      else if (u >= 0xE0 && u <= 0xEF) {
+        st->need = 2;
+        if (u == 0xE0) st->lo = 0xA0;
+        if (u == 0xED) st->hi = 0x9F;
+      }
+      else if (u >= 0xF0 && u <= 0xF4) {
+        st->need = 3;
+        if (u == 0xF0) st->lo = 0x90;
+        if (u == 0xF4) st->hi = 0x8F;
+      }
+      else {
+        return i - 1;
+      }
+    }
+  }
+
+  return -1;
+}
+
+/*
+ * at the end of input, `n` chars long: if a sequence is cut short there,
+ * return the index of its first char, else return -1
+ * */
+long utf8_end(const struct Utf8State* st, long n) {
+  return st->need > 0 ? n - st->have : -1;
+}
+
+#define LINES_DROP 0x1000
+
+/*
+ * byte offset, from `origin`, of the start of every line, line `first` first
+ * a run that starts at a checkpoint has its `origin` there
+ * the starts of lines already lexed are dropped, `dropped` so far, so that
+ * the table stays as small as the lookahead
+ * */
+struct LineTable {
+  int64_t* start;
+  long n;
+  long cap;
+  long dropped;
+  long origin;
+  int first;
+};
+
+void lines_init(struct LineTable* t) {
+  t->cap = 0x400;
+  t->start = (int64_t*)malloc(t->cap * sizeof(int64_t));
+  t->start[0] = 0;
+  t->n = 1;
+  t->dropped = 0;
+  t->origin = 0;
+  t->first = 1;
+}
+
+void lines_push(struct LineTable* t, long offset) {
+  if (t->n == t->cap) {
+    t->cap *= 2;
+    t->start = (int64_t*)realloc(t->start, t->cap * sizeof(int64_t));
+  }
+  t->start[t->n++] = offset - t->origin;
+}
+
+/*
+ * add the lines that start in the `n` bytes at `p`, `offset` in the input
+ * needs 16 readable bytes past `p + n`
+ * */
+void lines_scan(struct LineTable* t, const char* p, int n, long offset) {
+
+#ifdef __SSE2__
+  const __m128i nl = _mm_set1_epi8('\n');
+
+  for (int i = 0; i < n; i += 16) {
+    unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + i)), nl));
+
+    if (n - i < 16) {
+      m &= (1u << (n - i)) - 1;
+    }
+    for (; m; m &= m - 1) {
+      lines_push(t, offset + i + __builtin_ctz(m) + 1);
     }
   }
+#else
+  for (int i = 0; i < n; i++) {
+    if (p[i] == '\n') {
+      lines_push(t, offset + i + 1);
+    }
+  }
+#endif
+}
+
+/*
+ * forget the starts before that of line index `k`, counted from `first`
+ * */
+void lines_drop(struct LineTable* t, long k) {
+  long m = k - t->dropped;
+  memmove(t->start, t->start + m, (t->n - m) * sizeof(int64_t));
+  t->n -= m;
+  t->dropped = k;
 }
 
+/*
+ * the halves are refilled from `fp`, or, when it is `NULL`, from the chunk
+ * handed to `lex_feed()`; a half that ends short then grows as more is fed
+ * */
 struct DoubleBuffer {
   FILE* fp;
+  const char* chunk;
+  long chunk_len;
+  boolean finished;
+  boolean starved;
   char* lexeme_begin;
   char* fwd;
-  char buf[2][BUF_SIZE + 1];
+  char buf[2][BUF_SIZE + PAD];
+  char* end[2];
+  boolean loaded[2];
+  boolean bs[2];
+  boolean eof;
+  boolean utf8;
+  struct Utf8State u8;
+  long n_read;
+  long bad_utf8;
+  long pos;
+  struct LineTable* lines;
   int lb_bf_n;
   int fwd_bf_n;
   int len;
@@ -1199,39 +1569,122 @@ struct DoubleBuffer {
 
 void db_init(struct DoubleBuffer* db, FILE* fp) {
   db->fp = fp;
+  db->chunk = NULL;
+  db->chunk_len = 0;
+  db->finished = fp != NULL;
+  db->starved = FALSE;
   db->lexeme_begin = &db->buf[1][BUF_SIZE];
   db->fwd = &db->buf[1][BUF_SIZE];
-  db->buf[0][BUF_SIZE] = '\0';
-  db->buf[1][BUF_SIZE] = EOF;
+  db->buf[1][BUF_SIZE] = '\0';
+  db->end[1] = &db->buf[1][BUF_SIZE];
+  db->loaded[0] = FALSE;
+  db->loaded[1] = FALSE;
+  db->eof = FALSE;
+  db->bs[0] = FALSE;
+  db->bs[1] = FALSE;
+  db->utf8 = FALSE;
+  db->u8.need = 0;
+  db->n_read = 0;
+  db->bad_utf8 = -1;
+  db->pos = 0;
+  db->lines = NULL;
   db->lb_bf_n = 1;
   db->fwd_bf_n = 1;
   db->len = 0;
 }
 
-char db_getc(struct DoubleBuffer* db) {
+/*
+ * append what there is to read to half `h`, up to `BUF_SIZE` bytes
+ * */
+void db_fill(struct DoubleBuffer* db, int h) {
 
-  if (*db->fwd == EOF) {
-    for (int i = 0; i < 2; i++) {
-      if (db->fwd == &db->buf[i][BUF_SIZE]) {
-        db->fwd_bf_n = OTHER(i);
-        char* new_buf = db->buf[db->fwd_bf_n];
+  char* p = db->end[h];
+  int n = &db->buf[h][BUF_SIZE] - p;
+  int rc;
 
-        if (new_buf[BUF_SIZE] != EOF) {
-          int rc = fread(new_buf, sizeof(char), BUF_SIZE, db->fp);
-          new_buf[rc] = EOF;
-          new_buf[BUF_SIZE] = EOF;
-        }
+  if (db->fp != NULL) {
+    rc = fread(p, sizeof(char), n, db->fp);
+  }
+  else {
+    rc = n < db->chunk_len ? n : db->chunk_len;
+    memcpy(p, db->chunk, rc);
+    db->chunk += rc;
+    db->chunk_len -= rc;
+  }
 
-        if (db->lexeme_begin == db->fwd) {
-          db->lexeme_begin = new_buf;
-          db->lb_bf_n = db->fwd_bf_n;
-          db->buf[i][BUF_SIZE] = '\0';
-        }
+  p[rc] = '\0';
+  db->end[h] = p + rc;
+  db->bs[h] = db->bs[h] || memchr(p, '\\', rc) != NULL;
 
-        db->fwd = new_buf;
-        break;
+  if (db->utf8 && db->bad_utf8 == -1) {
+    long k = utf8_check(p, rc, &db->u8);
+    if (k != -1) {
+      db->bad_utf8 = db->n_read + k;
+    }
+  }
+
+  if (db->lines != NULL) {
+    lines_scan(db->lines, p, rc, db->n_read);
+  }
+  db->n_read += rc;
+}
+
+/*
+ * nothing more to read for now: `eof` if nothing more will come,
+ * else `starved` until `lex_feed()` brings more
+ * */
+char db_stop(struct DoubleBuffer* db) {
+
+  if (db->finished) {
+    db->eof = TRUE;
+    if (db->utf8 && db->bad_utf8 == -1) {
+      db->bad_utf8 = utf8_end(&db->u8, db->n_read);
+    }
+  }
+  else {
+    db->starved = TRUE;
+  }
+
+  return '\0';
+}
+
+/*
+ * the byte after the data of a half is a '\0' sentinel, so `end` is only
+ * looked at when a '\0' is read, and any other byte is data
+ * when there is nothing more to read, see `db_stop()`, `fwd` is not moved
+ * */
+char __db_getc(struct DoubleBuffer* db) {
+
+  while (*db->fwd == '\0' && db->fwd == db->end[db->fwd_bf_n]) {
+    int i = db->fwd_bf_n;
+    int h = OTHER(i);
+
+    if (db->fwd != &db->buf[i][BUF_SIZE]) {
+      if (db->fp == NULL && db->chunk_len > 0) {
+        db_fill(db, i);
+        continue;
       }
+      return db_stop(db);
     }
+
+    if (!db->loaded[h]) {
+      if (db->fp == NULL && db->chunk_len == 0) {
+        return db_stop(db);
+      }
+      db->end[h] = db->buf[h];
+      db->bs[h] = FALSE;
+      db_fill(db, h);
+      db->loaded[h] = TRUE;
+    }
+
+    if (db->lexeme_begin == db->fwd) {
+      db->lexeme_begin = db->buf[h];
+      db->lb_bf_n = h;
+      db->loaded[i] = FALSE;
+    }
+
+    db->fwd = db->buf[h];
+    db->fwd_bf_n = h;
   }
 
   db->len++;
@@ -1239,155 +1692,5092 @@ char db_getc(struct DoubleBuffer* db) {
   return *db->fwd++;
 }
 
-void __db_ptok_nonfull(char* s, int len) {
-  char tmp = s[len];
-  s[len] = '\0';
-  printf("%s", s);
-  s[len] = tmp;
+/*
+ * read the next char with every backslash-newline deleted
+ * `len` still counts the deleted chars
+ * */
+char db_getc(struct DoubleBuffer* db) {
+
+  char c = __db_getc(db);
+
+  while (c == '\\') {
+    if (__db_getc(db) != '\n') {
+      if (db->eof) {
+        // the backslash is the last char, `eof` comes with the next read
+        db->eof = FALSE;
+        break;
+      }
+      if (db->starved) {
+        // read the backslash again once the next char is here
+        db->fwd--;
+        db->len--;
+        return '\0';
+      }
+      // `fwd` is never at the start of a half here, so just step back
+      db->fwd--;
+      db->len--;
+      break;
+    }
+    c = __db_getc(db);
+  }
+
+  return c;
 }
 
-void db_ptok(struct DoubleBuffer* db, int len) {
-  // assume that len <= BUF_SIZE
+/*
+ * the `k`th char after `lexeme_begin`
+ * */
+char* db_at(struct DoubleBuffer* db, int k) {
   int remain = &db->buf[db->lb_bf_n][BUF_SIZE] - db->lexeme_begin;
+  return k < remain ? db->lexeme_begin + k : &db->buf[OTHER(db->lb_bf_n)][k - remain];
+}
 
-  if (remain >= len) {
-    __db_ptok_nonfull(db->lexeme_begin, len);
-  } else {
-    __db_ptok_nonfull(db->lexeme_begin, remain);
-    __db_ptok_nonfull(db->buf[OTHER(db->lb_bf_n)], len - remain);
+/*
+ * if the `k`th char after `lexeme_begin` is half of a backslash-newline, return `1`
+ * */
+boolean db_spliced(struct DoubleBuffer* db, int k, int len) {
+  char c = *db_at(db, k);
+  return (c == '\\' && k + 1 < len && *db_at(db, k + 1) == '\n')
+    || (c == '\n' && k > 0 && *db_at(db, k - 1) == '\\');
+}
+
+/*
+ * number of backslash-newlines in the first `len` chars
+ * */
+int db_splices(struct DoubleBuffer* db, int len) {
+
+  if (!db->bs[0] && !db->bs[1]) {
+    return 0;
+  }
+
+  int n = 0;
+  for (int k = 1; k < len; k++) {
+    if (*db_at(db, k) == '\n' && *db_at(db, k - 1) == '\\') {
+      n++;
+    }
+  }
+
+  return n;
+}
+
+/*
+ * number of backslash-newlines before the first char of the lexeme
+ * */
+int db_lead_splices(struct DoubleBuffer* db, int len) {
+
+  int n = 0;
+
+  if (db->bs[0] || db->bs[1]) {
+    while (2 * n + 1 < len && *db_at(db, 2 * n) == '\\' && *db_at(db, 2 * n + 1) == '\n') {
+      n++;
+    }
   }
+
+  return n;
 }
 
-void db_move(struct DoubleBuffer* db, int len) {
+/*
+ * return the number of backslash-newlines moved over
+ * */
+int db_move(struct DoubleBuffer* db, int len) {
   // assume that len <= BUF_SIZE
   int remain = &db->buf[db->lb_bf_n][BUF_SIZE] - db->lexeme_begin;
+  int n = db_splices(db, len);
+
+  db->pos += len;
 
   if (remain >= len) {
     db->lexeme_begin += len;
   } else {
-    db->buf[db->lb_bf_n][BUF_SIZE] = '\0';
+    db->loaded[db->lb_bf_n] = FALSE;
     db->lb_bf_n = OTHER(db->lb_bf_n);
     db->lexeme_begin = &db->buf[db->lb_bf_n][len - remain];
   }
   db->fwd = db->lexeme_begin;
   db->fwd_bf_n = db->lb_bf_n;
   db->len = 0;
+  db->eof = FALSE;
+
+  return n;
+}
+
+/*
+ * copy the lexeme to `dst`, without backslash-newlines
+ * return its length
+ * */
+int db_copy(struct DoubleBuffer* db, char* dst, int len) {
+  // assume that len <= BUF_SIZE
+  int n = 0;
+
+  for (int k = 0; k < len; k++) {
+    if (!db_spliced(db, k, len)) {
+      dst[n++] = *db_at(db, k);
+    }
+  }
+  dst[n] = '\0';
+
+  return n;
+}
+
+/*
+ * let `lexeme_begin` catch up with `fwd`
+ * return the number of backslash-newlines moved over
+ * */
+int db_commit(struct DoubleBuffer* db) {
+  int n = db_splices(db, db->len);
+
+  if (db->lb_bf_n != db->fwd_bf_n) {
+    db->pos += &db->buf[db->lb_bf_n][BUF_SIZE] - db->lexeme_begin + (db->fwd - db->buf[db->fwd_bf_n]);
+    db->loaded[db->lb_bf_n] = FALSE;
+    db->lb_bf_n = db->fwd_bf_n;
+  }
+  else {
+    db->pos += db->fwd - db->lexeme_begin;
+  }
+  db->lexeme_begin = db->fwd;
+  db->len = 0;
+
+  return n;
+}
+
+/*
+ * read the rest of the line into `s` without '\n', at most `size - 1` chars
+ * `fwd` is left after them, `lexeme_begin` is not moved
+ * */
+void db_peekline(struct DoubleBuffer* db, char* s, int size) {
+  // assume that size <= BUF_SIZE
+  int i = 0;
+
+  for (char c; i < size - 1 && (c = db_getc(db)) != '\n' && !db->eof; i++) {
+    s[i] = c;
+  }
+  s[i] = '\0';
+}
+
+/*
+ * consume the rest of the line and its '\n'
+ * at end of file, `fwd` is left at the end
+ * */
+void db_skip_line(struct DoubleBuffer* db) {
+
+  for (;;) {
+    char c = db_getc(db);
+
+    if (c == '\n' || db->eof) {
+      break;
+    }
+    db_commit(db);
+  }
+
+  db_commit(db);
 }
 
 int db_get_len(struct DoubleBuffer* db) {
   return db->len;
 }
 
-void update_len(enum ParseResult* rv, int* len, int n, struct DoubleBuffer* db, int n_line) {
+/*
+ * read all of `fp`, followed by `PAD` zero bytes
+ * */
+char* load_file(FILE* fp, long* size) {
+
+  long cap = BUF_SIZE;
+  long n = 0;
+  char* s = (char*)malloc(cap + PAD);
+
+  for (;;) {
+    n += fread(s + n, sizeof(char), cap - n, fp);
+
+    if (n < cap) {
+      break;
+    }
+
+    cap *= 2;
+    s = (char*)realloc(s, cap + PAD);
+  }
+
+  memset(s + n, 0, PAD);
+  *size = n;
+
+  return s;
+}
+
+/*
+ * return the first char of `set` (at most 4 chars) in [`p`, `end`), or `end`
+ * newlines skipped over are added to `n_line`, unless it is `NULL`
+ * needs `PAD` readable bytes past `end`
+ * */
+const char* skip_to_any(const char* p, const char* end, const char* set, int* n_line) {
+
+#ifdef __SSE2__
+  int n = strlen(set);
+  const __m128i s0 = _mm_set1_epi8(set[0]);
+  const __m128i s1 = _mm_set1_epi8(set[n > 1 ? 1 : 0]);
+  const __m128i s2 = _mm_set1_epi8(set[n > 2 ? 2 : 0]);
+  const __m128i s3 = _mm_set1_epi8(set[n > 3 ? 3 : 0]);
+  const __m128i nl = _mm_set1_epi8('\n');
+
+  for (; p < end; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    unsigned m = _mm_movemask_epi8(_mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(v, s0), _mm_cmpeq_epi8(v, s1)),
+      _mm_or_si128(_mm_cmpeq_epi8(v, s2), _mm_cmpeq_epi8(v, s3))));
+    unsigned lines = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+
+    if (end - p < 16) {
+      m &= (1u << (end - p)) - 1;
+      lines &= (1u << (end - p)) - 1;
+    }
+
+    if (m) {
+      int k = __builtin_ctz(m);
+      if (n_line != NULL) {
+        *n_line += __builtin_popcount(lines & ((1u << k) - 1));
+      }
+      return p + k;
+    }
+
+    if (n_line != NULL) {
+      *n_line += __builtin_popcount(lines);
+    }
+  }
+
+  return end;
+#else
+  for (; p < end; p++) {
+    if (strchr(set, *p) != NULL && *p != '\0') {
+      return p;
+    }
+    if (*p == '\n' && n_line != NULL) {
+      (*n_line)++;
+    }
+  }
+
+  return end;
+#endif
+}
+
+/*
+ * run parser `i` from `p` as long as it is incomplete
+ * return the first char not taken by it
+ * */
+const char* skip_token(const char* p, const char* end, int i, int* n_line) {
+
+  boolean rst = TRUE;
+  struct ParseState ps;
+
+  for (; p < end; p++) {
+    enum ParseResult r = token_parser(*p, rst, i, &ps);
+    rst = FALSE;
+
+    if (r == PARSE_END) {
+      return p;
+    }
+    if (*p == '\n') {
+      (*n_line)++;
+    }
+    if (r == PARSE_SUCCESS && i != NTYPES) {
+      return p + 1;
+    }
+  }
+
+  return end;
+}
+
+/*
+ * if [`p`, `q`) ends with blanks after a '\n', return `1`
+ * `bol` tells whether `p` is itself at the start of a line
+ * */
+boolean blank_tail(const char* p, const char* q, boolean bol) {
+  while (q > p && (q[-1] == ' ' || q[-1] == '\t')) {
+    q--;
+  }
+  return q == p ? bol : q[-1] == '\n';
+}
+
+/*
+ * if the '#' at `p`, which begins its line, starts `#include "x"` or
+ * `#include <x>`, print `x`
+ * return the first char not looked at
+ * */
+const char* scan_directive(const char* p, const char* end, int n_line) {
+
+  for (p++; p < end && (*p == ' ' || *p == '\t'); p++)
+    ;
+
+  static const char include[] = "include";
+  if (end - p < (long)sizeof(include) - 1 || strncmp(p, include, sizeof(include) - 1) != 0) {
+    return p;
+  }
+
+  for (p += sizeof(include) - 1; p < end && (*p == ' ' || *p == '\t'); p++)
+    ;
+
+  if (p == end || (*p != '\"' && *p != '<')) {
+    return p;
+  }
+
+  char close = *p == '<' ? '>' : '\"';
+  const char* q = p + 1;
+
+  for (; q < end && *q != close && *q != '\n'; q++)
+    ;
+
+  if (q == end || *q != close) {
+    return q;
+  }
+
+  printf("%d <INCLUDE,%.*s>\n", n_line, (int)(q + 1 - p), p);
+
+  return q + 1;
+}
+
+/*
+ * print the `#include` targets of `fp`, skipping comments,
+ * character constants and strings
+ * */
+void scan_deps(FILE* fp) {
+
+  long size;
+  char* s = load_file(fp, &size);
+  const char* end = s + size;
+  int n_line = 1;
+  // whether only blanks and comments lie between the start of a line and `from`
+  const char* from = s;
+  boolean bol = TRUE;
+
+  for (const char* p = s; (p = skip_to_any(p, end, "#/\"'", &n_line)) != end; from = p) {
+    boolean at_bol = blank_tail(from, p, bol);
+
+    bol = FALSE;
+
+    switch (*p) {
+
+      case '#':
+        p = at_bol ? scan_directive(p, end, n_line) : p + 1;
+        break;
+
+      case '/':
+        if (p[1] == '/' || p[1] == '*') {
+          p = skip_token(p, end, NTYPES, &n_line);
+          bol = at_bol;
+        }
+        else {
+          p++;
+        }
+        break;
+
+      case '\"':
+        p = skip_token(p, end, 5, &n_line);
+        break;
+
+      case '\'':
+        p = skip_token(p, end, 4, &n_line);
+        break;
+    }
+  }
+
+  free(s);
+}
+
+#define COND_DEPTH 64
+#define LINE_PEEK 64
+
+/*
+ * preprocessing conditionals known to `--skip-if0`
+ * */
+enum Cond {
+  COND_NONE,
+  COND_IF0,
+  COND_IF1,
+  COND_IF,
+  COND_ELIF0,
+  COND_ELIF1,
+  COND_ELIF,
+  COND_ELSE,
+  COND_ENDIF
+};
+
+struct CondStack {
+  int depth;
+  enum Cond kind[COND_DEPTH];
+};
+
+void cond_push(struct CondStack* cs, enum Cond k) {
+  if (cs->depth < COND_DEPTH) {
+    cs->kind[cs->depth] = k;
+  }
+  cs->depth++;
+}
+
+enum Cond cond_top(struct CondStack* cs) {
+  if (cs->depth == 0) {
+    return COND_NONE;
+  }
+  return cs->depth <= COND_DEPTH ? cs->kind[cs->depth - 1] : COND_IF;
+}
+
+/*
+ * what an `#elif` found out about the branch it is in
+ * */
+void cond_set_top(struct CondStack* cs, enum Cond k) {
+  if (cs->depth > 0 && cs->depth <= COND_DEPTH) {
+    cs->kind[cs->depth - 1] = k;
+  }
+}
+
+enum Cond cond_pop(struct CondStack* cs) {
+  enum Cond k = cond_top(cs);
+  if (cs->depth > 0) {
+    cs->depth--;
+  }
+  return k;
+}
+
+const char* skip_blank(const char* s) {
+  while (*s == ' ' || *s == '\t') {
+    s++;
+  }
+  return s;
+}
+
+/*
+ * classify a directive line, `s` is what follows the '#'
+ * */
+enum Cond cond_type(const char* s) {
+
+  s = skip_blank(s);
+
+  int l = 0;
+  while (IS_IDENT_START(s[l]) && s[l] != '_') {
+    l++;
+  }
+
+  boolean elif = l == 4 && strncmp(s, "elif", 4) == 0;
+
+  if ((l == 2 && strncmp(s, "if", 2) == 0) || elif) {
+    const char* v = skip_blank(s + l);
+    const char* r = skip_blank(v + 1);
+
+    if ((*v == '0' || *v == '1')
+      && (*r == '\0' || strncmp(r, "//", 2) == 0 || strncmp(r, "/*", 2) == 0)) {
+      if (elif) {
+        return *v == '0' ? COND_ELIF0 : COND_ELIF1;
+      }
+      return *v == '0' ? COND_IF0 : COND_IF1;
+    }
+    return elif ? COND_ELIF : COND_IF;
+  }
+  if ((l == 5 && strncmp(s, "ifdef", 5) == 0) || (l == 6 && strncmp(s, "ifndef", 6) == 0)) {
+    return COND_IF;
+  }
+  if (l == 4 && strncmp(s, "else", 4) == 0) {
+    return COND_ELSE;
+  }
+  if (l == 5 && strncmp(s, "endif", 5) == 0) {
+    return COND_ENDIF;
+  }
+
+  return COND_NONE;
+}
+
+/*
+ * skip the comment, character constant or string that `c`, just read,
+ * begins in a dead branch; a constant not closed on its line ends there
+ * return whether the next char begins a line, which for a block comment,
+ * taken as a blank, is `bol`, what it was for `c`
+ * */
+boolean skip_dead_token(struct DoubleBuffer* db, char c, boolean bol) {
+
+  char d = db_getc(db);
+
+  if (c == '/' && d == '/') {
+    db_skip_line(db);
+    return TRUE;
+  }
+
+  if (c == '/' && d == '*') {
+    for (char prev = '\0'; !db->eof; prev = d) {
+      db_commit(db);
+      d = db_getc(db);
+      if (prev == '*' && d == '/') {
+        break;
+      }
+    }
+    db_commit(db);
+    return bol;
+  }
+
+  if (c == '/') {
+    // a lone '/', the char after it is looked at again
+    db_move(db, 0);
+    return FALSE;
+  }
+
+  while (d != c && d != '\n' && !db->eof) {
+    if (d == '\\') {
+      db_getc(db);
+    }
+    db_commit(db);
+    d = db_getc(db);
+  }
+  db_commit(db);
+
+  return d == '\n';
+}
+
+/*
+ * skip a dead branch, up to the `#elif`, `#else` or `#endif` that ends it,
+ * jumping from '#' to '#' instead of reading every char
+ * comments, character constants and strings are skipped whole, so no '#'
+ * in them is taken for a directive
+ * */
+void skip_inactive(struct DoubleBuffer* db, struct CondStack* cs) {
+
+  int depth = 0;
+  boolean bol = TRUE;
+
+  for (;;) {
+    // make `fwd` point into a loaded half
+    db_getc(db);
+
+    if (db->eof) {
+      db_commit(db);
+      return;
+    }
+
+    char* p = --db->fwd;
+    char* end = db->end[db->fwd_bf_n];
+
+    char* h = (char*)skip_to_any(p, end, "#/\"'", NULL);
+    boolean at_bol = blank_tail(p, h, bol);
+
+    if (h == end) {
+      bol = at_bol;
+      db->fwd = end;
+      db_commit(db);
+      continue;
+    }
+
+    if (*h != '#') {
+      db->fwd = h + 1;
+      db_commit(db);
+      bol = skip_dead_token(db, *h, at_bol);
+      continue;
+    }
+
+    // `lexeme_begin` is left at the '#', for an `#elif` to be lexed
+    db->fwd = h;
+    db_commit(db);
+    db_getc(db);
+    bol = FALSE;
+
+    if (!at_bol) {
+      db_commit(db);
+      continue;
+    }
+
+    char s[LINE_PEEK];
+    db_peekline(db, s, sizeof(s));
+    db_move(db, 0);
+
+    enum Cond k = cond_type(s);
+
+    if (k == COND_ELIF && depth == 0 && cond_top(cs) == COND_IF0) {
+      // which branch is taken is not known from here on
+      cond_set_top(cs, COND_IF);
+      return;
+    }
+
+    db_skip_line(db);
+    bol = TRUE;
+
+    switch (k) {
+
+      case COND_IF0:
+      case COND_IF1:
+      case COND_IF:
+        depth++;
+        break;
+
+      case COND_ELIF1:
+        if (depth == 0 && cond_top(cs) == COND_IF0) {
+          cond_set_top(cs, COND_IF1);
+          return;
+        }
+        break;
+
+      case COND_ELSE:
+        if (depth == 0 && cond_top(cs) == COND_IF0) {
+          return;
+        }
+        break;
+
+      case COND_ENDIF:
+        if (depth == 0) {
+          cond_pop(cs);
+          return;
+        }
+        depth--;
+        break;
+
+      default:
+        break;
+    }
+  }
+}
+
+/*
+ * called when a token starts with a '#' that begins its line
+ * if the directive is taken (with any dead branch after it), return `1`
+ * else `fwd` is put back and the line is lexed as usual
+ * */
+boolean cond_directive(struct DoubleBuffer* db, struct CondStack* cs) {
+
+  char s[LINE_PEEK];
+  db_peekline(db, s, sizeof(s));
+  db_move(db, 0);
+
+  enum Cond k = cond_type(s);
+
+  switch (k) {
+
+    case COND_IF0:
+    case COND_IF1:
+      cond_push(cs, k);
+      db_skip_line(db);
+      if (k == COND_IF0) {
+        skip_inactive(db, cs);
+      }
+      return TRUE;
+
+    case COND_IF:
+      cond_push(cs, k);
+      break;
+
+    case COND_ELIF0:
+    case COND_ELIF1:
+    case COND_ELIF:
+      // once a branch is taken, the rest are dead
+      if (cond_top(cs) == COND_IF1) {
+        db_skip_line(db);
+        skip_inactive(db, cs);
+        return TRUE;
+      }
+      break;
+
+    case COND_ELSE:
+      if (cond_top(cs) == COND_IF1) {
+        db_skip_line(db);
+        skip_inactive(db, cs);
+        return TRUE;
+      }
+      if (cond_top(cs) == COND_IF0) {
+        db_skip_line(db);
+        return TRUE;
+      }
+      break;
+
+    case COND_ENDIF:
+      k = cond_pop(cs);
+      if (k == COND_IF0 || k == COND_IF1) {
+        db_skip_line(db);
+        return TRUE;
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  db_getc(db); // take the '#' again
+  return FALSE;
+}
+
+/*
+ * lex's side of a `tokring.h` ring, and what it has not published yet
+ * */
+struct TokWriter {
+  struct TokRing* r;
+  struct TokRecord* records;
+  uint32_t head;
+};
+
+void tokring_publish(struct TokWriter* w) {
+  __atomic_store_n(&w->r->head, w->head, __ATOMIC_SEQ_CST);
+  tokring_wake(&w->r->readable, &w->r->reader_waits, 0);
+}
+
+/*
+ * write a record, waiting for room if the consumer is a ring behind
+ * records are published a batch at a time
+ * */
+void tokring_push(struct TokWriter* w, int type, long offset, int len, int line) {
+
+  struct TokRing* r = w->r;
+
+  while (w->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == r->slots) {
+    // the consumer has to see the full ring to make room in it
+    tokring_publish(w);
+
+    uint32_t seen = __atomic_load_n(&r->writable, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&r->writer_waits, 1, __ATOMIC_SEQ_CST);
+
+    if (w->head - __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) == r->slots) {
+      tokring_wait(&r->writable, seen);
+    }
+  }
+
+  struct TokRecord* t = &w->records[w->head & (r->slots - 1)];
+  t->offset = offset;
+  t->len = len;
+  t->line = line;
+  t->type = type;
+
+  if ((++w->head & (TOKRING_BATCH - 1)) == 0) {
+    tokring_publish(w);
+  }
+}
+
+uint64_t hash_bytes(const char* p, long n) {
+
+  uint64_t h = 14695981039346656037u;
+
+  for (long i = 0; i < n; i++) {
+    h = (h ^ (unsigned char)p[i]) * 1099511628211u;
+  }
+
+  return h;
+}
+
+/*
+ * a lexeme of `--tokens`, by its chars in the pool of `TokEncoder`
+ * */
+struct Lexeme {
+  uint64_t hash;
+  long text;
+  uint32_t len;
+  uint32_t id;           // plus one, 0 for a free slot
+};
+
+/*
+ * lex's side of `--tokens=FILE`, see `tokstream.h`: the columns of the
+ * block being built and the ids of the lexemes written so far
+ * */
+struct TokEncoder {
+  FILE* fp;
+  unsigned char* col[TOKSTREAM_COLUMNS];
+  long col_len[TOKSTREAM_COLUMNS];
+  long col_cap[TOKSTREAM_COLUMNS];
+  long n;
+  int type;
+  long run;
+  int line;
+  long end;
+  struct Lexeme* slot;
+  long n_slots;
+  long n_lexemes;
+  char* pool;
+  long pool_len;
+  long pool_cap;
+};
+
+void tokenc_init(struct TokEncoder* e, FILE* fp) {
+
+  e->fp = fp;
+  for (int i = 0; i < TOKSTREAM_COLUMNS; i++) {
+    e->col_cap[i] = 0x10000;
+    e->col[i] = (unsigned char*)malloc(e->col_cap[i]);
+    e->col_len[i] = 0;
+  }
+  e->n = 0;
+  e->run = 0;
+  e->line = 0;
+  e->end = 0;
+  e->n_slots = 0x10000;
+  e->slot = (struct Lexeme*)calloc(e->n_slots, sizeof(struct Lexeme));
+  e->n_lexemes = 0;
+  e->pool_cap = 0x100000;
+  e->pool = (char*)malloc(e->pool_cap);
+  e->pool_len = 0;
+
+  fwrite(TOKSTREAM_MAGIC, 1, 8, fp);
+}
+
+/*
+ * room for `len` more bytes in column `i`, return where they go
+ * */
+unsigned char* tokenc_col(struct TokEncoder* e, int i, long len) {
+
+  while (e->col_len[i] + len > e->col_cap[i]) {
+    e->col_cap[i] *= 2;
+    e->col[i] = (unsigned char*)realloc(e->col[i], e->col_cap[i]);
+  }
+
+  return e->col[i] + e->col_len[i];
+}
+
+void tokenc_varint(struct TokEncoder* e, int i, uint64_t v) {
+  unsigned char* p = tokenc_col(e, i, 10);
+  e->col_len[i] = tokstream_put(p, v) - e->col[i];
+}
+
+/*
+ * return the id of the `len` chars at `s`, -1 if they are new,
+ * in which case they get the next id
+ * */
+long tokenc_intern(struct TokEncoder* e, const char* s, int len) {
+
+  uint64_t h = hash_bytes(s, len);
+  long i = h & (e->n_slots - 1);
+
+  for (; e->slot[i].id != 0; i = (i + 1) & (e->n_slots - 1)) {
+    struct Lexeme* x = &e->slot[i];
+    if (x->hash == h && x->len == (uint32_t)len && memcmp(e->pool + x->text, s, len) == 0) {
+      return x->id - 1;
+    }
+  }
+
+  while (e->pool_len + len > e->pool_cap) {
+    e->pool_cap *= 2;
+    e->pool = (char*)realloc(e->pool, e->pool_cap);
+  }
+  memcpy(e->pool + e->pool_len, s, len);
+  e->slot[i] = (struct Lexeme){ h, e->pool_len, len, ++e->n_lexemes };
+  e->pool_len += len;
+
+  // kept at most half full
+  if (2 * e->n_lexemes > e->n_slots) {
+    struct Lexeme* old = e->slot;
+    long n = e->n_slots;
+
+    e->n_slots *= 2;
+    e->slot = (struct Lexeme*)calloc(e->n_slots, sizeof(struct Lexeme));
+    for (long k = 0; k < n; k++) {
+      if (old[k].id != 0) {
+        long j = old[k].hash & (e->n_slots - 1);
+        while (e->slot[j].id != 0) {
+          j = (j + 1) & (e->n_slots - 1);
+        }
+        e->slot[j] = old[k];
+      }
+    }
+    free(old);
+  }
+
+  return -1;
+}
+
+/*
+ * deflate the block and write it out
+ * */
+void tokenc_flush(struct TokEncoder* e) {
+
+  if (e->run > 0) {
+    *tokenc_col(e, 0, 1) = e->type;
+    e->col_len[0]++;
+    tokenc_varint(e, 0, e->run);
+    e->run = 0;
+  }
+
+  long raw_len = 0;
+  for (int i = 0; i < TOKSTREAM_COLUMNS; i++) {
+    raw_len += 10 + e->col_len[i];
+  }
+
+  unsigned char* raw = (unsigned char*)malloc(raw_len);
+  unsigned char* p = raw;
+  for (int i = 0; i < TOKSTREAM_COLUMNS; i++) {
+    p = tokstream_put(p, e->col_len[i]);
+    memcpy(p, e->col[i], e->col_len[i]);
+    p += e->col_len[i];
+    e->col_len[i] = 0;
+  }
+  raw_len = p - raw;
+
+  uLongf packed_len = compressBound(raw_len);
+  unsigned char* packed = (unsigned char*)malloc(packed_len);
+  unsigned char head[30];
+
+  compress2(packed, &packed_len, raw, raw_len, Z_DEFAULT_COMPRESSION);
+  p = tokstream_put(tokstream_put(tokstream_put(head, e->n), raw_len), packed_len);
+  fwrite(head, 1, p - head, e->fp);
+  fwrite(packed, 1, packed_len, e->fp);
+
+  free(raw);
+  free(packed);
+  e->n = 0;
+}
+
+/*
+ * add a token, `s` being its `l` chars less backslash-newlines
+ * */
+void tokenc_push(struct TokEncoder* e, int type, long offset, int len, int line, const char* s, int l) {
+
+  if (e->run > 0 && type != e->type) {
+    *tokenc_col(e, 0, 1) = e->type;
+    e->col_len[0]++;
+    tokenc_varint(e, 0, e->run);
+    e->run = 0;
+  }
+  e->type = type;
+  e->run++;
+
+  tokenc_varint(e, 1, line - e->line);
+  tokenc_varint(e, 2, offset - e->end);
+  tokenc_varint(e, 3, len - l);
+
+  long id = tokenc_intern(e, s, l);
+  if (id == -1) {
+    tokenc_varint(e, 4, e->n_lexemes - 1);
+    tokenc_varint(e, 5, l);
+    memcpy(tokenc_col(e, 5, l), s, l);
+    e->col_len[5] += l;
+  }
+  else {
+    tokenc_varint(e, 4, id);
+  }
+
+  e->line = line;
+  e->end = offset + len;
+
+  if (++e->n == TOKSTREAM_BLOCK) {
+    tokenc_flush(e);
+  }
+}
+
+/*
+ * write what is left and the end of the stream; return -1 on a write error
+ * */
+int tokenc_close(struct TokEncoder* e) {
+
+  unsigned char end = 0;
+
+  if (e->n > 0) {
+    tokenc_flush(e);
+  }
+  fwrite(&end, 1, 1, e->fp);
+
+  for (int i = 0; i < TOKSTREAM_COLUMNS; i++) {
+    free(e->col[i]);
+  }
+  free(e->slot);
+  free(e->pool);
+
+  return fclose(e->fp) == 0 ? 0 : -1;
+}
+
+/*
+ * called with each token: its line, its type and its chars without
+ * backslash-newlines, which only live until the callback returns
+ * */
+typedef void (*TokenCallback)(void* arg, int line, int type, const char* s, int len);
+
+/*
+ * the `parse()` loop and everything it keeps between chars, so that it
+ * can stop when the input runs dry and go on when more is fed
+ * lexers share nothing, so any number can run at once, on any threads
+ * */
+struct Lexer {
+  struct DoubleBuffer db;
+  unsigned only;
+  unsigned mask;
+  boolean skip_if0;
+  TokenCallback on_token[NTYPES];
+  void* arg;
+  struct TokWriter* ring;
+  struct TokEncoder* enc;
+  struct LineTable lines;
+  long line_idx;
+  int n[NTYPES];
+  int len[NTYPES + 1];
+  enum ParseResult rv[NTYPES + 1];
+  struct ParseState ps;
+  boolean rst;
+  boolean in_cmt;
+  boolean bol;
+  struct CondStack cs;
+  long from;
+  long to;
+  FILE* ckpt;
+  long ckpt_every;
+  long ckpt_next;
+};
+
+/*
+ * let `handler` be called with the tokens of `type`, or none if `NULL`
+ * a type with no handler is only counted, its chars are never copied
+ * */
+void lex_set_handler(struct Lexer* lx, int type, TokenCallback handler) {
+
+  lx->on_token[type] = handler;
+
+  if (handler != NULL) {
+    lx->only |= 1u << type;
+  }
+  else {
+    lx->only &= ~(1u << type);
+  }
+
+  // keywords are only told apart from identifiers when a token ends,
+  // so the trie is not walked per char unless KEYWORD is wanted
+  lx->mask = ~0u;
+  if (!(lx->only & 1u)) {
+    lx->mask &= ~1u;
+  }
+}
+
+/*
+ * read from `fp`, or, when it is `NULL`, from `lex_feed()`
+ * the types set in `only` are handed to `on_token`, see `lex_set_handler()`
+ * */
+void lex_init(struct Lexer* lx, FILE* fp, unsigned only, TokenCallback on_token, void* arg) {
+
+  db_init(&lx->db, fp);
+  lx->only = 0;
+  lx->arg = arg;
+  lx->ring = NULL;
+  lx->enc = NULL;
+  lx->skip_if0 = FALSE;
+
+  for (int i = 0; i < NTYPES; i++) {
+    lex_set_handler(lx, i, only >> i & 1u ? on_token : NULL);
+  }
+
+  lines_init(&lx->lines);
+  lx->db.lines = &lx->lines;
+  lx->line_idx = 0;
+  set(lx->n, NTYPES, 0);
+  set(lx->len, NTYPES + 1, 0);
+  lx->rst = TRUE;
+  lx->in_cmt = FALSE;
+  lx->bol = TRUE;
+  lx->cs.depth = 0;
+  lx->from = 0;
+  lx->to = LONG_MAX;
+  lx->ckpt = NULL;
+}
+
+/*
+ * let `lx` write the tokens it would hand to a handler to the ring `w`,
+ * by offset and length in the input, backslash-newlines inside the token
+ * included
+ * */
+void lex_share(struct Lexer* lx, struct TokWriter* w) {
+  lx->ring = w;
+}
+
+/*
+ * let `lx` write the tokens it would hand to a handler to the stream `e`
+ * */
+void lex_encode(struct Lexer* lx, struct TokEncoder* e) {
+  lx->enc = e;
+}
+
+/*
+ * line of the byte at `offset`, which never goes backwards
+ * */
+int lex_line(struct Lexer* lx, long offset) {
+
+  struct LineTable* t = lx->db.lines;
+
+  while (lx->line_idx + 1 < t->n + t->dropped && t->start[lx->line_idx + 1 - t->dropped] <= offset - t->origin) {
+    lx->line_idx++;
+  }
+  if (lx->line_idx - t->dropped >= LINES_DROP) {
+    lines_drop(t, lx->line_idx);
+  }
+
+  return lx->line_idx + t->first;
+}
+
+/*
+ * number of lines read so far
+ * */
+int lex_lines(struct Lexer* lx) {
+  return lx->db.lines->n + lx->db.lines->dropped + lx->db.lines->first - 1;
+}
+
+/*
+ * hand the first `len` chars of the lexeme to `on_token`
+ * */
+void lex_emit(struct Lexer* lx, int type, int len) {
+
+  if (lx->ring != NULL) {
+    if (lx->on_token[type] != NULL) {
+      long offset = lx->db.pos + 2 * db_lead_splices(&lx->db, len);
+      tokring_push(lx->ring, type, offset, len - (offset - lx->db.pos), lex_line(lx, offset));
+    }
+  }
+  else if (lx->enc != NULL) {
+    if (lx->on_token[type] != NULL) {
+      char s[2 * BUF_SIZE + 1];
+      int l = db_copy(&lx->db, s, len);
+      long offset = lx->db.pos + 2 * db_lead_splices(&lx->db, len);
+      tokenc_push(lx->enc, type, offset, len - (offset - lx->db.pos), lex_line(lx, offset), s, l);
+    }
+  }
+  else if (lx->on_token[type] != NULL) {
+    char s[2 * BUF_SIZE + 1];
+    int l = db_copy(&lx->db, s, len);
+    lx->on_token[type](lx->arg, lex_line(lx, lx->db.pos + 2 * db_lead_splices(&lx->db, len)), type, s, l);
+  }
+}
+
+void update_len(struct Lexer* lx) {
+
+  int l = db_get_len(&lx->db);
+
+  if (l >= BUF_SIZE) {
+    if (lx->db.pos >= lx->from) {
+      lex_emit(lx, NTYPES - 1, l);
+    }
+    db_move(&lx->db, l);
+    set(lx->len, NELEMS(lx->len), 0);
+    return;
+  }
+
+  for (int i = 0; i < (int)NELEMS(lx->rv); i++) {
+    if (lx->rv[i] == PARSE_SUCCESS) {
+      lx->len[i] = l;
+    }
+  }
+}
+
+/*
+ * a token boundary to restart from, see `lex_resume()`
+ * comments and strings are whole lexemes, so a boundary is never in one,
+ * and all that is carried over is whether a `#` would start a directive
+ * */
+struct Checkpoint {
+  int64_t offset;
+  int32_t line;
+  uint32_t flags;
+};
+
+#define CKPT_BOL 1u
+#define CKPT_MAGIC "lexckpt1"
+
+/*
+ * the sidecar is `CKPT_MAGIC`, the interval as an `int64_t`, then the
+ * checkpoints in order of offset; each is flushed once it is written,
+ * so the sidecar of an interrupted run is good up to where it stopped
+ * */
+void lex_checkpoints(struct Lexer* lx, FILE* out, long every) {
+  lx->ckpt = out;
+  lx->ckpt_every = every;
+  lx->ckpt_next = lx->db.pos + every;
+}
+
+void lex_checkpoint(struct Lexer* lx) {
+
+  struct Checkpoint c;
+
+  c.offset = lx->db.pos;
+  c.line = lex_line(lx, lx->db.pos);
+  c.flags = lx->bol ? CKPT_BOL : 0;
+
+  fwrite(&c, sizeof(c), 1, lx->ckpt);
+  fflush(lx->ckpt);
+  lx->ckpt_next = lx->db.pos + lx->ckpt_every;
+}
+
+/*
+ * start at `c` instead of the beginning, the `FILE` is seeked there
+ * call it right after `lex_init()`
+ * */
+void lex_resume(struct Lexer* lx, const struct Checkpoint* c) {
+
+  if (lx->db.fp != NULL) {
+    fseek(lx->db.fp, c->offset, SEEK_SET);
+  }
+
+  lx->db.pos = c->offset;
+  lx->db.n_read = c->offset;
+  lx->db.lines->origin = c->offset;
+  lx->db.lines->first = c->line;
+  lx->bol = c->flags & CKPT_BOL ? TRUE : FALSE;
+}
+
+/*
+ * only hand out the tokens that start in [`from`, `to`), and stop at `to`
+ * */
+void lex_range(struct Lexer* lx, long from, long to) {
+  lx->from = from;
+  lx->to = to;
+}
+
+/*
+ * number of whole checkpoints in the sidecar `f`, `every` is its interval
+ * return -1 if `f` is not a sidecar
+ * */
+long ckpt_count(FILE* f, long* every) {
+
+  char magic[8];
+  int64_t n;
+
+  rewind(f);
+  if (fread(magic, 1, 8, f) != 8 || memcmp(magic, CKPT_MAGIC, 8) != 0 || fread(&n, sizeof(n), 1, f) != 1) {
+    return -1;
+  }
+  *every = n;
+
+  fseek(f, 0, SEEK_END);
+  return (ftell(f) - 16) / sizeof(struct Checkpoint);
+}
+
+void ckpt_read(FILE* f, long i, struct Checkpoint* c) {
+  fseek(f, 16 + i * sizeof(struct Checkpoint), SEEK_SET);
+  if (fread(c, sizeof(*c), 1, f) != 1) {
+    c->offset = 0;
+  }
+}
+
+/*
+ * the last of the `n` checkpoints in `f` at or before `offset`,
+ * or the beginning of the input if there is none
+ * return its index, or -1 for the beginning
+ * */
+long ckpt_find(FILE* f, long n, long offset, struct Checkpoint* c) {
+
+  long lo = -1;
+  long hi = n;
+
+  while (hi - lo > 1) {
+    long mid = (lo + hi) / 2;
+    ckpt_read(f, mid, c);
+    if (c->offset <= offset) {
+      lo = mid;
+    }
+    else {
+      hi = mid;
+    }
+  }
+
+  if (lo == -1) {
+    c->offset = 0;
+    c->line = 1;
+    c->flags = CKPT_BOL;
+  }
+  else {
+    ckpt_read(f, lo, c);
+  }
+
+  return lo;
+}
+
+/*
+ * run the `parse()` loop until the input runs dry
+ * if the end of input, or of the range, is reached, return `1`
+ * else return `0`, `lex_feed()` goes on from there
+ * */
+boolean lex_run(struct Lexer* lx) {
+
+  struct DoubleBuffer* db = &lx->db;
+
+  for (;;) {
+    char c = db_getc(db);
+
+    if (c == '\0' && db->starved) {
+      db->starved = FALSE;
+      return FALSE;
+    }
+
+    if (lx->skip_if0 && lx->rst && lx->bol && c == '#' && cond_directive(db, &lx->cs)) {
+      continue;
+    }
+
+    parse(c, lx->rst, lx->rv, NELEMS(lx->rv), lx->mask, &lx->ps);
+    lx->rst = FALSE;
+
+    // nothing is read past the end
+    if (c == '\0' && db->eof) {
+      set((int*)lx->rv, NELEMS(lx->rv), PARSE_END);
+    }
+
+    if (all(lx->rv, NELEMS(lx->rv), PARSE_END)) {
+      int i = max_idx(lx->len, NELEMS(lx->len));
+
+      if (i != -1) {
+        int type = i;
+
+        if (i == 1 && !(lx->mask & 1u)) {
+          char s[BUF_SIZE + 1];
+
+          if (db_copy(db, s, lx->len[i]) <= KEYWORD_MAX_LEN && is_keyword(s)) {
+            type = 0;
+          }
+        }
+
+        if (i != NTYPES) {
+          if (db->pos >= lx->from) {
+            lex_emit(lx, type, lx->len[i]);
+            lx->n[type]++;
+          }
+          lx->bol = FALSE;
+        }
+
+        db_move(db, lx->len[i]);
+      }
+      else {
+        if (c == '\0' && db->eof) {
+          return TRUE;
+        }
+
+        if (lx->in_cmt) {
+          // `c` is not part of the comment, read it again
+          db_move(db, 0);
+        }
+        else {
+          if (c == '\n') {
+            lx->bol = TRUE;
+          }
+          else if (c != ' ' && c != '\t') {
+            lx->bol = FALSE;
+          }
+
+          db_move(db, db_get_len(db));
+        }
+      }
+
+      set(lx->len, NELEMS(lx->len), 0);
+      lx->rst = TRUE;
+      lx->in_cmt = FALSE;
+
+      if (db->pos >= lx->to) {
+        return TRUE;
+      }
+      if (lx->ckpt != NULL && db->pos >= lx->ckpt_next) {
+        lex_checkpoint(lx);
+      }
+    }
+    else if (lx->in_cmt) {
+      db_move(db, db_get_len(db));
+    }
+    else {
+      update_len(lx);
+
+      if (all(lx->rv, NELEMS(lx->rv) - 1, PARSE_END)) {
+        db_move(db, lx->len[NTYPES]);
+        set(lx->len, NELEMS(lx->len), 0);
+        lx->in_cmt = TRUE;
+      }
+    }
+  }
+}
+
+/*
+ * lex the `len` bytes at `p`, a token may go on into the next chunk
+ * the bytes are not needed after the call; `skip_if0` needs a `FILE`
+ * */
+void lex_feed(struct Lexer* lx, const char* p, long len) {
+  lx->db.chunk = p;
+  lx->db.chunk_len = len;
+  lex_run(lx);
+}
+
+/*
+ * no more input, lex what is left
+ * */
+void lex_finish(struct Lexer* lx) {
+  lx->db.finished = TRUE;
+  lex_run(lx);
+}
+
+void lex_free(struct Lexer* lx) {
+  free(lx->lines.start);
+}
+
+/*
+ * the `TokenCallback` of the command line
+ * */
+void print_token(void* arg, int line, int type, const char* s, int len) {
+  (void)arg;
+  printf("%d <%s,", line, token_name(type));
+  fwrite(s, sizeof(char), len, stdout);
+  printf(">\n");
+}
+
+/*
+ * write `line <TYPE,` at `p`, as `print_token()` prints it,
+ * return the end; it is at most `TOKEN_HEAD_MAX` chars
+ * */
+#define TOKEN_HEAD_MAX 24
+
+char* token_head(char* p, int line, int type) {
+
+  char digits[12];
+  int n = 0;
+
+  do {
+    digits[n++] = '0' + line % 10;
+    line /= 10;
+  } while (line > 0);
+  while (n > 0) {
+    *p++ = digits[--n];
+  }
+
+  const char* name = token_name(type);
+  int l = strlen(name);
+
+  *p++ = ' ';
+  *p++ = '<';
+  memcpy(p, name, l);
+  p += l;
+  *p++ = ',';
+
+  return p;
+}
+
+#define RING_SLOTS 4
+#define RING_SLOT_SIZE 0x100000
+
+/*
+ * a single-producer single-consumer ring of buffers, lock-free:
+ * the producer only writes `head` and the consumer only writes `tail`
+ * a side that has to wait sleeps on the other's counter, and says so in
+ * `head_waits` or `tail_waits` so the other wakes it only then
+ * */
+struct Ring {
+  char* buf[RING_SLOTS];
+  long len[RING_SLOTS];
+  _Atomic unsigned head;
+  _Atomic unsigned tail;
+  _Atomic unsigned head_waits;
+  _Atomic unsigned tail_waits;
+};
+
+void ring_init(struct Ring* q) {
+  for (int i = 0; i < RING_SLOTS; i++) {
+    q->buf[i] = (char*)malloc(RING_SLOT_SIZE);
+  }
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+  atomic_init(&q->head_waits, 0);
+  atomic_init(&q->tail_waits, 0);
+}
+
+/*
+ * sleep until `*word` is no longer `seen`, after saying so in `*waits`;
+ * `word` is looked at again first, so a move made meanwhile is not missed
+ * */
+void ring_wait(_Atomic unsigned* word, _Atomic unsigned* waits, unsigned seen) {
+
+  atomic_store(waits, 1);
+  if (atomic_load(word) == seen) {
+    syscall(SYS_futex, (unsigned*)word, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+  }
+}
+
+/*
+ * after moving `*word`, wake the other side if it sleeps on it
+ * */
+void ring_wake(_Atomic unsigned* word, _Atomic unsigned* waits) {
+
+  if (atomic_exchange(waits, 0)) {
+    syscall(SYS_futex, (unsigned*)word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  }
+}
+
+void ring_free(struct Ring* q) {
+  for (int i = 0; i < RING_SLOTS; i++) {
+    free(q->buf[i]);
+  }
+}
+
+/*
+ * the producer side: wait for a free slot and return its buffer,
+ * then hand it over with `ring_put()`
+ * */
+char* ring_get_free(struct Ring* q) {
+
+  unsigned head = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+  while (head - atomic_load_explicit(&q->tail, memory_order_acquire) == RING_SLOTS) {
+    ring_wait(&q->tail, &q->tail_waits, head - RING_SLOTS);
+  }
+
+  return q->buf[head % RING_SLOTS];
+}
+
+void ring_put(struct Ring* q, long len) {
+
+  unsigned head = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+  q->len[head % RING_SLOTS] = len;
+  atomic_store(&q->head, head + 1);
+  ring_wake(&q->head, &q->head_waits);
+}
+
+/*
+ * the consumer side: wait for a full slot and return its buffer,
+ * then give it back with `ring_release()`
+ * */
+char* ring_get(struct Ring* q, long* len) {
+
+  unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+  while (atomic_load_explicit(&q->head, memory_order_acquire) == tail) {
+    ring_wait(&q->head, &q->head_waits, tail);
+  }
+
+  *len = q->len[tail % RING_SLOTS];
+  return q->buf[tail % RING_SLOTS];
+}
+
+void ring_release(struct Ring* q) {
+  atomic_fetch_add(&q->tail, 1);
+  ring_wake(&q->tail, &q->tail_waits);
+}
+
+/*
+ * the reader, lexer and writer threads of `--pipeline`
+ * the reader starts with the `pre_len` bytes at `pre`, already read from
+ * `fp`, and inflates the input if it is gzip
+ * the lexer formats tokens into `out`, a slot of `output`;
+ * a slot of length 0 ends either ring
+ * */
+struct Pipeline {
+  FILE* fp;
+  const char* prog;
+  const char* name;
+  const char* pre;
+  long pre_len;
+  struct Ring input;
+  struct Ring output;
+  char* out;
+  long out_len;
+  boolean bad;         // the reader met bad gzip data or a read error, set before it ends the ring
+};
+
+boolean is_gzip(const char* p, long n) {
+  return n >= 2 && (unsigned char)p[0] == 0x1f && (unsigned char)p[1] == 0x8b;
+}
+
+/*
+ * what `gz_input()` reads through: the gzip `fp` inflated, or, when it
+ * only looked like gzip, the `pre_len` bytes taken from it then the rest
+ * bad gzip data ends the input early and makes closing it fail
+ * */
+struct GzInput {
+  FILE* fp;
+  const char* prog;
+  const char* name;
+  boolean gz;
+  boolean end;
+  boolean bad;
+  char pre[2];
+  int pre_len;
+  z_stream z;
+  char in[0x10000];
+};
+
+ssize_t gz_input_read(void* cookie, char* buf, size_t size) {
+
+  struct GzInput* g = (struct GzInput*)cookie;
+
+  if (!g->gz) {
+    if (g->pre_len > 0) {
+      int n = size < (size_t)g->pre_len ? (int)size : g->pre_len;
+      memcpy(buf, g->pre, n);
+      memmove(g->pre, g->pre + n, g->pre_len - n);
+      g->pre_len -= n;
+      return n;
+    }
+    return fread(buf, 1, size, g->fp);
+  }
+
+  g->z.next_out = (Bytef*)buf;
+  g->z.avail_out = size;
+
+  // as `pipe_inflate()`, but stop as soon as there is something
+  while (g->z.avail_out == size && !g->end) {
+    if (g->z.avail_in == 0) {
+      long n = fread(g->in, 1, sizeof(g->in), g->fp);
+
+      if (n == 0) {
+        // a clean end leaves the stream reset, waiting for the next member
+        if (g->z.total_in != 0) {
+          fprintf(stderr, "%s: %s: bad or truncated gzip data\n", g->prog, g->name);
+          g->bad = TRUE;
+        }
+        g->end = TRUE;
+        break;
+      }
+      g->z.next_in = (Bytef*)g->in;
+      g->z.avail_in = n;
+    }
+
+    int rc = inflate(&g->z, Z_NO_FLUSH);
+    if (rc == Z_STREAM_END) {
+      inflateReset(&g->z);
+    }
+    else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+      fprintf(stderr, "%s: %s: bad or truncated gzip data\n", g->prog, g->name);
+      g->bad = TRUE;
+      g->end = TRUE;
+    }
+  }
+
+  return size - g->z.avail_out;
+}
+
+int gz_input_close(void* cookie) {
+
+  struct GzInput* g = (struct GzInput*)cookie;
+  int rc = g->bad ? -1 : 0;
+
+  if (g->gz) {
+    inflateEnd(&g->z);
+  }
+  free(g);
+
+  return rc;
+}
+
+/*
+ * look at the first bytes of `*fp` and, if it is gzip, replace it with
+ * a `FILE` that inflates it; close the replacement, not `*fp`, when done
+ * only reads through the `FILE`, so it works with no descriptor, and
+ * reads of the descriptor afterwards would miss what it took
+ * */
+boolean gz_input(FILE** fp, const char* prog, const char* name) {
+
+  int c = getc(*fp);
+
+  if (c != 0x1f) {
+    if (c != EOF) {
+      ungetc(c, *fp);
+    }
+    return FALSE;
+  }
+
+  struct GzInput* g = (struct GzInput*)malloc(sizeof(struct GzInput));
+  static const cookie_io_functions_t io = { gz_input_read, NULL, NULL, gz_input_close };
+
+  g->fp = *fp;
+  g->prog = prog;
+  g->name = name;
+  g->end = FALSE;
+  g->bad = FALSE;
+  g->pre[0] = c;
+  g->pre_len = 1;
+  if ((c = getc(*fp)) != EOF) {
+    g->pre[g->pre_len++] = c;
+  }
+  g->gz = is_gzip(g->pre, g->pre_len);
+
+  if (g->gz) {
+    memset(&g->z, 0, sizeof(g->z));
+    inflateInit2(&g->z, 16 + MAX_WBITS);
+    memcpy(g->in, g->pre, 2);
+    g->z.next_in = (Bytef*)g->in;
+    g->z.avail_in = 2;
+  }
+
+  *fp = fopencookie(g, "r", io);
+  return g->gz;
+}
+
+/*
+ * read up to `n` bytes into `p`, 0 at the end; a read error is reported
+ * and ends the input as the end would
+ * */
+long pipe_read(struct Pipeline* pl, char* p, long n) {
+
+  long got;
+
+  // a cached file has no descriptor
+  if (fileno(pl->fp) < 0) {
+    got = fread(p, 1, n, pl->fp);
+    if (got == 0 && ferror(pl->fp)) {
+      got = -1;
+    }
+  }
+  else {
+    while ((got = read(fileno(pl->fp), p, n)) < 0 && errno == EINTR) {
+    }
+  }
+
+  if (got < 0) {
+    printf("%s: cannot read %s: %s\n", pl->prog, pl->name, strerror(errno));
+    pl->bad = TRUE;
+    return 0;
+  }
+
+  return got;
+}
+
+/*
+ * inflate the rest of the input into `input`, starting with the `n`
+ * bytes in `p`, the free slot of `input`; members that follow one
+ * another are inflated one after another, as `gzip -d` does
+ * */
+void pipe_inflate(struct Pipeline* pl, char* p, long n) {
+
+  z_stream z;
+  char* in = (char*)malloc(RING_SLOT_SIZE);
+  int rc = Z_OK;
+
+  memset(&z, 0, sizeof(z));
+  inflateInit2(&z, 16 + MAX_WBITS);
+  memcpy(in, p, n);
+  z.next_in = (Bytef*)in;
+  z.avail_in = n;
+  z.next_out = (Bytef*)p;
+  z.avail_out = RING_SLOT_SIZE;
+
+  for (;;) {
+    if (z.avail_in == 0) {
+      if ((n = pipe_read(pl, in, RING_SLOT_SIZE)) == 0) {
+        break;
+      }
+      z.next_in = (Bytef*)in;
+      z.avail_in = n;
+    }
+
+    rc = inflate(&z, Z_NO_FLUSH);
+    if (rc == Z_STREAM_END) {
+      inflateReset(&z);
+    }
+    else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+      break;
+    }
+
+    if (z.avail_out == 0) {
+      ring_put(&pl->input, RING_SLOT_SIZE);
+      p = ring_get_free(&pl->input);
+      z.next_out = (Bytef*)p;
+      z.avail_out = RING_SLOT_SIZE;
+    }
+  }
+
+  // a clean end leaves the stream reset, waiting for the next member
+  if ((rc != Z_STREAM_END && rc != Z_BUF_ERROR && rc != Z_OK) || z.total_in != 0) {
+    fprintf(stderr, "%s: %s: bad or truncated gzip data\n", pl->prog, pl->name);
+    pl->bad = TRUE;
+  }
+
+  if (z.avail_out < RING_SLOT_SIZE) {
+    ring_put(&pl->input, RING_SLOT_SIZE - z.avail_out);
+    ring_get_free(&pl->input);
+  }
+  ring_put(&pl->input, 0);
+
+  inflateEnd(&z);
+  free(in);
+}
+
+void* pipe_reader(void* arg) {
+
+  struct Pipeline* pl = (struct Pipeline*)arg;
+  char* p = ring_get_free(&pl->input);
+  long n = pl->pre_len;
+
+  memcpy(p, pl->pre, n);
+  if (n == 0) {
+    n = pipe_read(pl, p, RING_SLOT_SIZE);
+  }
+
+  if (is_gzip(p, n)) {
+    pipe_inflate(pl, p, n);
+    return NULL;
+  }
+
+  while (n > 0) {
+    ring_put(&pl->input, n);
+    p = ring_get_free(&pl->input);
+    n = pipe_read(pl, p, RING_SLOT_SIZE);
+  }
+  ring_put(&pl->input, 0);
+
+  return NULL;
+}
+
+void* pipe_writer(void* arg) {
+
+  struct Pipeline* pl = (struct Pipeline*)arg;
+  long n;
+
+  for (;;) {
+    char* p = ring_get(&pl->output, &n);
+    if (n == 0) {
+      break;
+    }
+    fwrite(p, sizeof(char), n, stdout);
+    ring_release(&pl->output);
+  }
+
+  return NULL;
+}
+
+void pipe_flush(struct Pipeline* pl) {
+  ring_put(&pl->output, pl->out_len);
+  pl->out = ring_get_free(&pl->output);
+  pl->out_len = 0;
+}
+
+/*
+ * the `TokenCallback` of `--pipeline`, prints as `print_token()` does
+ * */
+void pipe_token(void* arg, int line, int type, const char* s, int len) {
+
+  struct Pipeline* pl = (struct Pipeline*)arg;
+
+  if (pl->out_len + TOKEN_HEAD_MAX + len + 2 > RING_SLOT_SIZE) {
+    pipe_flush(pl);
+  }
+
+  char* p = token_head(pl->out + pl->out_len, line, type);
+
+  memcpy(p, s, len);
+  p += len;
+  *p++ = '>';
+  *p++ = '\n';
+
+  pl->out_len = p - pl->out;
+}
+
+/*
+ * lex `fp` with `lx`, set up with `pipe_token()` and `pl`, while one
+ * thread reads ahead and another writes behind
+ * the first `pre_len` bytes of `fp` have already been read into `pre`
+ * */
+void pipe_run(struct Pipeline* pl, struct Lexer* lx, FILE* fp, const char* prog, const char* name, const char* pre, long pre_len) {
+
+  pthread_t reader;
+  pthread_t writer;
+  long n;
+
+  pl->fp = fp;
+  pl->prog = prog;
+  pl->name = name;
+  pl->pre = pre;
+  pl->pre_len = pre_len;
+  ring_init(&pl->input);
+  ring_init(&pl->output);
+  pl->out = ring_get_free(&pl->output);
+  pl->out_len = 0;
+  pl->bad = FALSE;
+
+  fflush(stdout);
+  pthread_create(&reader, NULL, pipe_reader, pl);
+  pthread_create(&writer, NULL, pipe_writer, pl);
+
+  for (;;) {
+    char* p = ring_get(&pl->input, &n);
+    if (n == 0) {
+      break;
+    }
+    lex_feed(lx, p, n);
+    ring_release(&pl->input);
+  }
+  lex_finish(lx);
+
+  if (pl->out_len > 0) {
+    pipe_flush(pl);
+  }
+  ring_put(&pl->output, 0);
+
+  pthread_join(reader, NULL);
+  pthread_join(writer, NULL);
+  ring_free(&pl->input);
+  ring_free(&pl->output);
+}
+
+/*
+ * set `lx` up from the sidecar `<name>.ckpt` of the command line:
+ * `--range` and `--resume` start at a checkpoint of it, `--checkpoints`
+ * writes it, or adds to it after the one `--resume` started at
+ * */
+FILE* open_sidecar(struct Lexer* lx, const char* prog, const char* name, long every, long from, long to, boolean resume) {
+
+  char path[FILENAME_MAX];
+  snprintf(path, sizeof(path), "%s.ckpt", name);
+
+  FILE* f = NULL;
+  struct Checkpoint c;
+  long n = 0;
+  long i = -1;
+  long old_every = 0;
+
+  if (from != -1 || resume) {
+    f = fopen(path, every != 0 ? "r+b" : "rb");
+    if (f == NULL || (n = ckpt_count(f, &old_every)) == -1) {
+      printf("%s: no checkpoints in %s\n", prog, path);
+      exit(EXIT_FAILURE);
+    }
+    if (every != 0 && every != old_every) {
+      printf("%s: %s has checkpoints every %ldKB\n", prog, path, old_every / 1024);
+      exit(EXIT_FAILURE);
+    }
+
+    i = ckpt_find(f, n, resume ? LONG_MAX : from, &c);
+    lex_resume(lx, &c);
+    lex_range(lx, resume ? c.offset : from, to);
+  }
+
+  if (every == 0) {
+    return f;
+  }
+
+  if (f == NULL) {
+    f = fopen(path, "wb");
+    if (f == NULL) {
+      printf("%s: cannot open %s\n", prog, path);
+      exit(EXIT_FAILURE);
+    }
+    int64_t e = every;
+    fwrite(CKPT_MAGIC, 1, 8, f);
+    fwrite(&e, sizeof(e), 1, f);
+  }
+  else {
+    // a torn checkpoint at the end of an interrupted run is written over
+    fseek(f, 16 + (i + 1) * sizeof(struct Checkpoint), SEEK_SET);
+  }
+
+  lex_checkpoints(lx, f, every);
+  return f;
+}
+
+void print_answer(int n_line, int* n, int len) {
+
+  printf("%d\n", n_line);
+
+  for (int i = 0; i < len - 1; i++) {
+    printf("%d ", n[i]);
+  }
+
+  printf("\n%d\n", n[len - 1]);
+}
+
+#define OUT_IOVS 1024
+#define OUT_SCRATCH 0x10000
+#define OUT_REF_MIN 64
+
+/*
+ * output gathered into iovecs: the text around the lexemes is copied into
+ * `scratch`, lexemes of `OUT_REF_MIN` chars or more are pointed to where
+ * they lie in the input, and the lot goes out with one `writev()`
+ * */
+struct Out {
+  int fd;
+  const char* prog;
+  struct iovec iov[OUT_IOVS];
+  int n_iov;
+  char scratch[OUT_SCRATCH];
+  int used;
+};
+
+void out_init(struct Out* o, int fd, const char* prog) {
+  fflush(stdout);
+  o->fd = fd;
+  o->prog = prog;
+  o->n_iov = 0;
+  o->used = 0;
+}
+
+void out_flush(struct Out* o) {
+
+  struct iovec* v = o->iov;
+  int n = o->n_iov;
+
+  while (n > 0) {
+    long rc = writev(o->fd, v, n);
+
+    if (rc < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "%s: cannot write output: %s\n", o->prog, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+
+    while (n > 0 && rc >= (long)v->iov_len) {
+      rc -= v->iov_len;
+      v++;
+      n--;
+    }
+    if (n > 0) {
+      v->iov_base = (char*)v->iov_base + rc;
+      v->iov_len -= rc;
+    }
+  }
+
+  o->n_iov = 0;
+  o->used = 0;
+}
+
+/*
+ * the `len` chars at `p` are copied, they may change after the call
+ * */
+void out_copy(struct Out* o, const char* p, int len) {
+
+  if (o->used + len > OUT_SCRATCH || o->n_iov == OUT_IOVS) {
+    out_flush(o);
+  }
+
+  char* q = o->scratch + o->used;
+
+  memcpy(q, p, len);
+  o->used += len;
+
+  if (o->n_iov > 0 && (char*)o->iov[o->n_iov - 1].iov_base + o->iov[o->n_iov - 1].iov_len == q) {
+    o->iov[o->n_iov - 1].iov_len += len;
+  }
+  else {
+    o->iov[o->n_iov].iov_base = q;
+    o->iov[o->n_iov].iov_len = len;
+    o->n_iov++;
+  }
+}
+
+/*
+ * the `len` chars at `p` must stay as they are until `out_close()`
+ * */
+void out_ref(struct Out* o, const char* p, int len) {
+
+  if (len < OUT_REF_MIN) {
+    out_copy(o, p, len);
+    return;
+  }
+
+  if (o->n_iov == OUT_IOVS) {
+    out_flush(o);
+  }
+
+  o->iov[o->n_iov].iov_base = (char*)p;
+  o->iov[o->n_iov].iov_len = len;
+  o->n_iov++;
+}
+
+void out_close(struct Out* o) {
+  out_flush(o);
+}
+
+/*
+ * two-stage structural index, `--engine=index`
+ *
+ * stage 1 turns the input, 64 chars at a time, into one bitmask per
+ * char class plus the spans that stage 1 believes are strings or comments;
+ * stage 2 walks the tokens: identifiers, keywords, plain strings and
+ * comments are settled from the masks, operators and delimiters from
+ * `punct_match()`, everything else is handed to the recognizers by
+ * `index_round()`, the `parse()` loop of `main()` run on memory
+ *
+ * the masks are only ever a hint: a fast path is taken when they agree with
+ * the chars, so the output is the same as `--engine=loop`
+ * */
+
+struct Index {
+  const char* s;
+  long n;
+  long nb;
+  uint64_t* ws;
+  uint64_t* nl;
+  uint64_t* ident;
+  uint64_t* quote;
+  uint64_t* bslash;
+  uint64_t* in_str;
+  uint64_t* in_cmt;
+  long line_pos;
+  int n_line;
+  boolean eof;
+  int count[NTYPES];
+  unsigned only;
+  unsigned mask;
+  struct Out* out;
+};
+
+uint64_t prefix_xor_shift(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+#ifdef __x86_64__
+/*
+ * carry-less multiply by all ones: bit `i` becomes the xor of bits 0..`i`
+ * */
+__attribute__((target("pclmul,sse2")))
+uint64_t prefix_xor_clmul(uint64_t x) {
+  __m128i r = _mm_clmulepi64_si128(_mm_set_epi64x(0, x), _mm_set1_epi8((char)0xFF), 0);
+  return (uint64_t)_mm_cvtsi128_si64(r);
+}
+#endif
+
+/*
+ * chars escaped by an odd run of backslashes
+ * `carry` is set when the block ends in such a run
+ * */
+uint64_t find_escaped(uint64_t bs, uint64_t* carry) {
+
+  const uint64_t even = 0x5555555555555555ULL;
+
+  bs &= ~*carry;
+  uint64_t follows = bs << 1 | *carry;
+  uint64_t odd_starts = bs & ~even & ~follows;
+  uint64_t seq_even;
+  *carry = __builtin_add_overflow(odd_starts, bs, &seq_even);
+
+  return (even ^ seq_even << 1) & follows;
+}
+
+/*
+ * bits of the 64 chars at `p` that are in `set`
+ * */
+uint64_t set_mask(const char* p, const char* set) {
+
+  uint64_t m = 0;
+
+#ifdef __SSE2__
+  __m128i v[4];
+  for (int i = 0; i < 4; i++) {
+    v[i] = _mm_loadu_si128((const __m128i*)(p + 16 * i));
+  }
+  for (; *set; set++) {
+    const __m128i k = _mm_set1_epi8(*set);
+    for (int i = 0; i < 4; i++) {
+      m |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v[i], k)) << 16 * i;
+    }
+  }
+#else
+  for (int i = 0; i < 64; i++) {
+    if (p[i] != '\0' && strchr(set, p[i]) != NULL) {
+      m |= 1ULL << i;
+    }
+  }
+#endif
+
+  return m;
+}
+
+/*
+ * bits of the 64 chars at `p` that are [A-Za-z0-9_]
+ * */
+uint64_t ident_mask(const char* p) {
+
+  uint64_t m = 0;
+
+#ifdef __SSE2__
+  for (int i = 0; i < 4; i++) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(p + 16 * i));
+    __m128i l = _mm_or_si128(v, _mm_set1_epi8(32));
+    __m128i r = _mm_and_si128(_mm_cmpgt_epi8(l, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(l, _mm_set1_epi8('z' + 1)));
+    r = _mm_or_si128(r, _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1))));
+    r = _mm_or_si128(r, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+    m |= (uint64_t)(unsigned)_mm_movemask_epi8(r) << 16 * i;
+  }
+#else
+  for (int i = 0; i < 64; i++) {
+    if (IS_IDENT(p[i])) {
+      m |= 1ULL << i;
+    }
+  }
+#endif
+
+  return m;
+}
+
+/*
+ * bits [`a`, `b`) of a word
+ * */
+uint64_t bits(int a, int b) {
+  uint64_t hi = b == 64 ? ~0ULL : (1ULL << b) - 1;
+  return hi & ~((1ULL << a) - 1);
+}
+
+enum Span {
+  SPAN_CODE,
+  SPAN_STR,
+  SPAN_CHR,
+  SPAN_LCMT,
+  SPAN_BCMT
+};
+
+/*
+ * string and comment spans of the block at `p`, one event at a time
+ * `skip` is set when the first char of the next block is already taken
+ * */
+void resolve_block(const char* p, uint64_t events, enum Span* span, boolean* skip,
+  uint64_t* in_str, uint64_t* in_cmt) {
+
+  int open = 0;
+  *in_str = 0;
+  *in_cmt = 0;
+
+  if (*skip) {
+    events &= ~1ULL;
+    *skip = FALSE;
+  }
+
+  for (; events; events &= events - 1) {
+    int i = __builtin_ctzll(events);
+    char c = p[i];
+
+    switch (*span) {
+
+      case SPAN_CODE:
+        if (c == '\"') {
+          *span = SPAN_STR;
+          open = i;
+        }
+        else if (c == '\'') {
+          *span = SPAN_CHR;
+        }
+        else if (c == '/' && (p[i + 1] == '/' || p[i + 1] == '*')) {
+          *span = p[i + 1] == '/' ? SPAN_LCMT : SPAN_BCMT;
+          open = i;
+          events &= ~(2ULL << i);
+          *skip = i == 63;
+        }
+        break;
+
+      case SPAN_STR:
+      case SPAN_CHR:
+        if (c == '\\') {
+          events &= ~(2ULL << i);
+          *skip = i == 63;
+        }
+        else if (c == '\n' || c == (*span == SPAN_STR ? '\"' : '\'')) {
+          if (*span == SPAN_STR) {
+            *in_str |= bits(open, i);
+          }
+          *span = SPAN_CODE;
+        }
+        break;
+
+      case SPAN_LCMT:
+        if (c == '\n') {
+          *in_cmt |= bits(open, i);
+          *span = SPAN_CODE;
+        }
+        break;
+
+      case SPAN_BCMT:
+        if (c == '*' && p[i + 1] == '/') {
+          *in_cmt |= bits(open, i + 1);
+          *span = SPAN_CODE;
+          events &= ~(2ULL << i);
+          *skip = i == 63;
+        }
+        break;
+    }
+  }
+
+  if (*span == SPAN_STR) {
+    *in_str |= bits(open, 64);
+  }
+  else if (*span == SPAN_LCMT || *span == SPAN_BCMT) {
+    *in_cmt |= bits(open, 64);
+  }
+}
+
+/*
+ * stage 1
+ * */
+void index_build(struct Index* x) {
+
+  uint64_t (*prefix_xor)(uint64_t) = prefix_xor_shift;
+#ifdef __x86_64__
+  if (__builtin_cpu_supports("pclmul")) {
+    prefix_xor = prefix_xor_clmul;
+  }
+#endif
+
+  enum Span span = SPAN_CODE;
+  boolean skip = FALSE;
+  uint64_t carry = 0;
+
+  for (long b = 0; b < x->nb; b++) {
+    const char* p = x->s + 64 * b;
+    uint64_t live = x->n - 64 * b >= 64 ? ~0ULL : bits(0, x->n - 64 * b);
+
+    uint64_t nl = set_mask(p, "\n") & live;
+    uint64_t bs = set_mask(p, "\\") & live;
+    uint64_t dq = set_mask(p, "\"") & live;
+    uint64_t other = set_mask(p, "\'/") & live;
+
+    x->ws[b] = set_mask(p, " \t\n") | ~live;
+    x->nl[b] = nl;
+    x->ident[b] = ident_mask(p) & live;
+    x->bslash[b] = bs;
+    x->quote[b] = dq & ~find_escaped(bs, &carry);
+
+    // with no comment or char constant around, strings are just
+    // the spans between unescaped quotes
+    uint64_t in_str = prefix_xor(x->quote[b]) ^ (span == SPAN_STR ? ~0ULL : 0);
+
+    if ((span == SPAN_CODE || span == SPAN_STR) && !skip && !other && !(in_str & nl)) {
+      x->in_str[b] = in_str;
+      x->in_cmt[b] = 0;
+      span = in_str >> 63 ? SPAN_STR : SPAN_CODE;
+      skip = span == SPAN_STR && carry;
+    }
+    else {
+      uint64_t events = dq | bs | nl | other | (set_mask(p, "*") & live);
+      resolve_block(p, events, &span, &skip, &x->in_str[b], &x->in_cmt[b]);
+    }
+  }
+}
+
+boolean bit_at(const uint64_t* bm, long p) {
+  return bm[p >> 6] >> (p & 63) & 1;
+}
+
+/*
+ * first bit of `bm` at or after `p` equal to `v`, or `limit`
+ * */
+long next_bit(const uint64_t* bm, long p, long limit, boolean v) {
+
+  for (long b = p >> 6; 64 * b < limit; b++) {
+    uint64_t w = v ? bm[b] : ~bm[b];
+
+    if (b == p >> 6) {
+      w &= ~0ULL << (p & 63);
+    }
+    if (w) {
+      long q = 64 * b + __builtin_ctzll(w);
+      return q < limit ? q : limit;
+    }
+  }
+
+  return limit;
+}
+
+/*
+ * line of the char at `p`, `p` never goes backwards
+ * */
+int index_line(struct Index* x, long p) {
+
+  while (x->line_pos < p) {
+    long b = x->line_pos >> 6;
+    int e = p - 64 * b >= 64 ? 64 : p - 64 * b;
+    x->n_line += __builtin_popcountll(x->nl[b] & bits(x->line_pos & 63, e));
+    x->line_pos = 64 * b + e;
+  }
+
+  return x->n_line;
+}
+
+/*
+ * number of backslash-newlines before the first char at `p`
+ * */
+int index_lead_splices(struct Index* x, long p, long len) {
+
+  int n = 0;
+
+  while (2 * n + 1 < len && x->s[p + 2 * n] == '\\' && x->s[p + 2 * n + 1] == '\n') {
+    n++;
+  }
+
+  return n;
+}
+
+/*
+ * like `db_getc()`, `eof` is set at the end
+ * */
+char index_getc(struct Index* x, long* p) {
+
+  while (*p < x->n) {
+    char c = x->s[(*p)++];
+
+    if (c == '\\' && *p < x->n && x->s[*p] == '\n') {
+      (*p)++;
+      continue;
+    }
+
+    return c;
+  }
+
+  x->eof = TRUE;
+  return '\0';
+}
+
+/*
+ * print the token of `len` chars at `p`, without backslash-newlines
+ * */
+void index_emit(struct Index* x, int type, long p, long len) {
+
+  if (!(x->only >> type & 1u)) {
+    return;
+  }
+
+  char head[TOKEN_HEAD_MAX];
+  int l = token_head(head, index_line(x, p + 2 * index_lead_splices(x, p, len)), type) - head;
+
+  out_copy(x->out, head, l);
+
+  if (next_bit(x->bslash, p, p + len, TRUE) == p + len) {
+    out_ref(x->out, x->s + p, len);
+  }
+  else {
+    for (long k = p; k < p + len; k++) {
+      if (!(x->s[k] == '\\' && k + 1 < p + len && x->s[k + 1] == '\n')
+        && !(x->s[k] == '\n' && k > p && x->s[k - 1] == '\\')) {
+        out_copy(x->out, x->s + k, 1);
+      }
+    }
+  }
+
+  out_copy(x->out, ">\n", 2);
+}
+
+/*
+ * one token of the `parse()` loop of `lex_run()`, from `begin`
+ * return where the next token may start, or -1 at end of input
+ * */
+long index_round(struct Index* x, long begin) {
+
+  int len[NTYPES + 1] = { 0 };
+  enum ParseResult rv[NTYPES + 1];
+  struct ParseState ps;
+  boolean rst = TRUE;
+  boolean in_cmt = FALSE;
+  long fwd = begin;
+
+  x->eof = FALSE;
+
+  for (;;) {
+    char c = index_getc(x, &fwd);
+    parse(c, rst, rv, NELEMS(rv), x->mask, &ps);
+    rst = FALSE;
+
+    if (c == '\0' && x->eof) {
+      set((int*)rv, NELEMS(rv), PARSE_END);
+    }
+
+    if (all(rv, NELEMS(rv), PARSE_END)) {
+      int i = max_idx(len, NELEMS(len));
+
+      if (i != -1) {
+        int type = i;
+
+        if (i == 1 && !(x->mask & 1u)) {
+          char s[BUF_SIZE + 1];
+          int l = 0;
+
+          for (long k = begin; k < begin + len[i]; k++) {
+            if (!(x->s[k] == '\\' && x->s[k + 1] == '\n') && !(x->s[k] == '\n' && k > begin && x->s[k - 1] == '\\')) {
+              s[l++] = x->s[k];
+            }
+          }
+          s[l] = '\0';
+
+          if (l <= KEYWORD_MAX_LEN && is_keyword(s)) {
+            type = 0;
+          }
+        }
+
+        if (i != NTYPES) {
+          index_emit(x, type, begin, len[i]);
+          x->count[type]++;
+        }
+
+        return begin + len[i];
+      }
+      else if (c == '\0' && x->eof) {
+        return -1;
+      }
+      else if (in_cmt) {
+        return begin;
+      }
+      else {
+        return fwd;
+      }
+    }
+    else if (in_cmt) {
+      begin = fwd;
+    }
+    else {
+      int l = fwd - begin;
+
+      if (l >= BUF_SIZE) {
+        index_emit(x, NTYPES - 1, begin, l);
+        begin = fwd;
+        set(len, NELEMS(len), 0);
+      }
+      else {
+        for (int i = 0; i < (int)NELEMS(rv); i++) {
+          if (rv[i] == PARSE_SUCCESS) {
+            len[i] = l;
+          }
+        }
+
+        if (all(rv, NELEMS(rv) - 1, PARSE_END)) {
+          begin += len[NELEMS(rv) - 1];
+          fwd = begin;
+          set(len, NELEMS(len), 0);
+          in_cmt = TRUE;
+        }
+      }
+    }
+  }
+}
+
+/*
+ * stage 2: the token at `p`
+ * return where the next token may start, or -1 at end of input
+ * */
+long index_token(struct Index* x, long p, boolean utf8) {
+
+  const char* s = x->s;
+  long n = x->n;
+
+  int accept;
+  int l = punct_match(s + p, &accept);
+  long e = p + PUNCT_MAX_LEN + 1 < n ? p + PUNCT_MAX_LEN + 1 : n;
+
+  // `.5` is a number, `/*` and `//` open comments, a backslash may splice
+  // a longer operator
+  if (l > 0 && !(s[p] == '.' && IS_DIGIT(s[p + 1]))
+    && !(s[p] == '/' && (s[p + 1] == '/' || s[p + 1] == '*'))
+    && next_bit(x->bslash, p, e, TRUE) == e) {
+    int type = accept == PUNCT_OPERATOR ? 2 : 3;
+    index_emit(x, type, p, l);
+    x->count[type]++;
+    return p + l;
+  }
+
+  if (bit_at(x->ident, p) && !IS_DIGIT(s[p])) {
+    long q = next_bit(x->ident, p, n, FALSE);
+    char c = s[q];
+
+    // a quote makes a prefix such as L"", a backslash may splice the name
+    if (q - p < BUF_SIZE && c != '\"' && c != '\'' && c != '\\' && !(utf8 && (c & 0x80))) {
+      char w[KEYWORD_MAX_LEN + 1];
+      int type = 1;
+
+      if (q - p <= KEYWORD_MAX_LEN) {
+        memcpy(w, s + p, q - p);
+        w[q - p] = '\0';
+        type = is_keyword(w) ? 0 : 1;
+      }
+
+      index_emit(x, type, p, q - p);
+      x->count[type]++;
+      return q;
+    }
+  }
+
+  boolean opens_cmt = bit_at(x->in_cmt, p) && (p == 0 || !bit_at(x->in_cmt, p - 1));
+  boolean opens_str = bit_at(x->in_str, p) && bit_at(x->quote, p) && (p == 0 || !bit_at(x->in_str, p - 1));
+
+  if (s[p] == '/' && s[p + 1] == '*' && opens_cmt) {
+    long q = next_bit(x->in_cmt, p, n, FALSE);
+
+    if (q < n && s[q] == '/' && next_bit(x->bslash, p, q, TRUE) == q) {
+      return q + 1;
+    }
+  }
+  else if (s[p] == '/' && s[p + 1] == '/' && opens_cmt) {
+    long q = next_bit(x->in_cmt, p, n, FALSE);
+
+    if (next_bit(x->bslash, p, q, TRUE) == q) {
+      return q;
+    }
+  }
+  else if (s[p] == '\"' && opens_str) {
+    long q = next_bit(x->in_str, p, n, FALSE);
+
+    if (q < n && s[q] == '\"' && q + 1 - p < BUF_SIZE && next_bit(x->bslash, p, q, TRUE) == q) {
+      index_emit(x, 5, p, q + 1 - p);
+      x->count[5]++;
+      return q + 1;
+    }
+  }
+
+  return index_round(x, p);
+}
+
+/*
+ * lex `fp` with the structural index, then print the answer
+ * */
+void index_lex(FILE* fp, unsigned only, boolean utf8, const char* prog, const char* name, int* n_line, int* n) {
+
+  struct Index x;
+  x.s = load_file(fp, &x.n);
+  x.line_pos = 0;
+  x.n_line = 1;
+  x.eof = FALSE;
+  x.only = only;
+  x.mask = only & 1u ? ~0u : ~1u;
+  x.out = (struct Out*)malloc(sizeof(struct Out));
+  out_init(x.out, fileno(stdout), prog);
+  set(x.count, NTYPES, 0);
+
+  if (utf8) {
+    struct Utf8State st = { 0 };
+    long k = utf8_check(x.s, x.n, &st);
+    if (k == -1) {
+      k = utf8_end(&st, x.n);
+    }
+    if (k != -1) {
+      fprintf(stderr, "%s: %s: invalid UTF-8 at byte %ld\n", prog, name, k);
+    }
+  }
+
+  x.nb = x.n / 64 + 1;
+
+  uint64_t** bms[] = {
+    &x.ws, &x.nl, &x.ident, &x.quote, &x.bslash, &x.in_str, &x.in_cmt
+  };
+  uint64_t* mem = (uint64_t*)calloc(NELEMS(bms) * x.nb, sizeof(uint64_t));
+  for (int i = 0; i < (int)NELEMS(bms); i++) {
+    *bms[i] = mem + i * x.nb;
+  }
+
+  index_build(&x);
+
+  // tokens are only ever separated by blanks
+  for (long p = 0; p != -1; ) {
+    p = next_bit(x.ws, p, x.n, FALSE);
+    p = p < x.n ? index_token(&x, p, utf8) : index_round(&x, p);
+  }
+
+  out_close(x.out);
+  print_answer(index_line(&x, x.n), x.count, NTYPES);
+
+  if (n_line != NULL) {
+    *n_line = index_line(&x, x.n);
+    memcpy(n, x.count, sizeof(x.count));
+  }
+
+  free(x.out);
+  free(mem);
+  free((char*)x.s);
+}
+
+/*
+ * parse `--only=TYPE[,TYPE]` into a mask of token types
+ * */
+unsigned parse_only(const char* prog, const char* arg) {
+
+  unsigned only = 0;
+
+  for (const char* p = arg; ; p++) {
+    int l = strcspn(p, ",");
+    int i = token_type(p, l);
+
+    if (i == -1) {
+      printf("%s: unknown token type %.*s\n", prog, l, p);
+      exit(EXIT_FAILURE);
+    }
+
+    only |= 1u << i;
+    p += l;
+
+    if (*p == '\0') {
+      break;
+    }
+  }
+
+  return only;
+}
+
+#define CACHE_BUCKETS 0x4000
+#define CACHE_MAX (256L << 20)
+
+/*
+ * the contents of the files `--serve` has been asked about, by absolute
+ * path; an entry is good while the file keeps its size and mtime
+ * the request threads of `--serve` change it under `cache_mu`; a forked
+ * child only reads its own copy
+ * */
+struct CacheEntry {
+  char* path;
+  char* buf;
+  long len;
+  long mtime;
+  struct CacheEntry* next;
+};
+
+static struct CacheEntry* cache[CACHE_BUCKETS];
+static long cache_size = 0;
+static pthread_mutex_t cache_mu = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * `name` from the directory `dir`, or the working directory if it is
+ * `NULL`, into `path` of `PATH_MAX` chars
+ * */
+void cache_path(const char* dir, const char* name, char* path) {
+
+  if (name[0] == '/' || (dir == NULL && getcwd(path, PATH_MAX) == NULL)) {
+    snprintf(path, PATH_MAX, "%s", name);
+  }
+  else {
+    if (dir != NULL) {
+      snprintf(path, PATH_MAX, "%s", dir);
+    }
+    int l = strlen(path);
+    snprintf(path + l, PATH_MAX - l, "/%s", name);
+  }
+}
+
+uint32_t hash_str(const char* s) {
+
+  uint32_t h = 2166136261u;
+
+  for (const char* p = s; *p != '\0'; p++) {
+    h = (h ^ (unsigned char)*p) * 16777619u;
+  }
+
+  return h;
+}
+
+struct CacheEntry** cache_slot(const char* path) {
+
+  struct CacheEntry** e = &cache[hash_str(path) % CACHE_BUCKETS];
+
+  while (*e != NULL && strcmp((*e)->path, path) != 0) {
+    e = &(*e)->next;
+  }
+
+  return e;
+}
+
+struct CacheEntry* cache_find(const char* name) {
+
+  char path[PATH_MAX];
+
+  if (cache_size == 0) {
+    return NULL;
+  }
+
+  cache_path(NULL, name, path);
+  return *cache_slot(path);
+}
+
+void cache_clear(void) {
+
+  for (int i = 0; i < CACHE_BUCKETS; i++) {
+    while (cache[i] != NULL) {
+      struct CacheEntry* e = cache[i];
+      cache[i] = e->next;
+      free(e->path);
+      free(e->buf);
+      free(e);
+    }
+  }
+
+  cache_size = 0;
+}
+
+/*
+ * make sure the entry of the regular file `name` in `dir` is up to date;
+ * the file is read without `cache_mu`, so requests do not wait on each
+ * other's reads, and only a fresh copy is put in
+ * */
+void cache_load(const char* dir, const char* name) {
+
+  char path[PATH_MAX];
+  struct stat st;
+
+  cache_path(dir, name, path);
+  if (stat(path, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size > CACHE_MAX / 4) {
+    return;
+  }
+
+  long mtime = st.st_mtim.tv_sec * 1000000000L + st.st_mtim.tv_nsec;
+
+  pthread_mutex_lock(&cache_mu);
+  struct CacheEntry* e = *cache_slot(path);
+  boolean fresh = e != NULL && e->len == st.st_size && e->mtime == mtime;
+  pthread_mutex_unlock(&cache_mu);
+
+  if (fresh) {
+    return;
+  }
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+
+  char* buf = (char*)malloc(st.st_size + 1);
+  long len = 0;
+  long n;
+
+  while (len < st.st_size && (n = read(fd, buf + len, st.st_size - len)) > 0) {
+    len += n;
+  }
+  close(fd);
+
+  if (len != st.st_size) {
+    free(buf);
+    return;
+  }
+
+  pthread_mutex_lock(&cache_mu);
+  struct CacheEntry** slot = cache_slot(path);
+  e = *slot;
+
+  // another request may have put in the same copy meanwhile
+  if (e != NULL && e->len == len && e->mtime == mtime) {
+    pthread_mutex_unlock(&cache_mu);
+    free(buf);
+    return;
+  }
+
+  if (e == NULL) {
+    if (cache_size + len > CACHE_MAX) {
+      cache_clear();
+      slot = cache_slot(path);
+    }
+    e = (struct CacheEntry*)malloc(sizeof(struct CacheEntry));
+    e->path = strdup(path);
+    e->buf = NULL;
+    e->len = 0;
+    e->next = NULL;
+    *slot = e;
+  }
+
+  cache_size += len - e->len;
+  free(e->buf);
+  e->buf = buf;
+  e->len = len;
+  e->mtime = mtime;
+  pthread_mutex_unlock(&cache_mu);
+}
+
+/*
+ * `fopen()`, from the cache when the file is in it
+ * */
+FILE* open_input(const char* name) {
+
+  struct CacheEntry* e = cache_find(name);
+
+  if (e != NULL) {
+    return fmemopen(e->buf, e->len, "r");
+  }
+
+  return fopen(name, "r");
+}
+
+#define LOAD_DEPTH 64
+#define LOAD_THREADS 8
+#define LOAD_READ 0x10000
+
+/*
+ * one file of `lex_files()`, read whole into `buf`
+ * `err` is the `errno` of a failed open or read
+ * */
+struct Job {
+  const char* name;
+  char* buf;
+  long len;
+  long cap;
+  int fd;
+  int err;
+  boolean done;
+  boolean cached;
+};
+
+#ifdef __NR_io_uring_setup
+struct Uring {
+  int fd;
+  unsigned* sq_tail;
+  unsigned sq_mask;
+  unsigned* sq_array;
+  struct io_uring_sqe* sqes;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe* cqes;
+  unsigned pending;
+};
+#endif
+
+/*
+ * reads the files ahead of the lexer, at most `LOAD_DEPTH` at a time,
+ * through io_uring, or else a pool of threads doing blocking reads
+ * the files are handed out in order, jobs [`next`, `started`) are in flight
+ * */
+struct Loader {
+  struct Job* job;
+  long n;
+  long next;
+  long started;
+  boolean uring;
+#ifdef __NR_io_uring_setup
+  struct Uring ring;
+#endif
+  pthread_t pool[LOAD_THREADS];
+  pthread_mutex_t mu;
+  pthread_cond_t cv;
+};
+
+void job_grow(struct Job* j) {
+  j->cap = j->cap == 0 ? LOAD_READ : 2 * j->cap;
+  j->buf = (char*)realloc(j->buf, j->cap);
+}
+
+#ifdef __NR_io_uring_setup
+#define URING_CLOSE ((uint64_t)-1)
+
+boolean uring_init(struct Uring* u, unsigned entries) {
+
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+
+  u->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (u->fd < 0) {
+    return FALSE;
+  }
+
+  // openat, read and close came in 5.6, after io_uring itself;
+  // a kernel that cannot tell which ops it has does not have them
+  int n_ops = IORING_OP_CLOSE > IORING_OP_READ ? IORING_OP_CLOSE + 1 : IORING_OP_READ + 1;
+  struct io_uring_probe* probe = (struct io_uring_probe*)calloc(1, sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op));
+  boolean ops = syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PROBE, probe, 256) == 0 && probe->last_op >= n_ops - 1
+    && (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED)
+    && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)
+    && (probe->ops[IORING_OP_CLOSE].flags & IO_URING_OP_SUPPORTED);
+
+  free(probe);
+  if (!ops) {
+    close(u->fd);
+    return FALSE;
+  }
+
+  size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    sq_size = cq_size = sq_size > cq_size ? sq_size : cq_size;
+  }
+
+  char* sq = (char*)mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  char* cq = sq;
+  if (sq != MAP_FAILED && !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    cq = (char*)mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+  }
+  void* sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+
+  if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+    close(u->fd);
+    return FALSE;
+  }
+
+  u->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+  u->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+  u->sq_array = (unsigned*)(sq + p.sq_off.array);
+  u->sqes = (struct io_uring_sqe*)sqes;
+  u->cq_head = (unsigned*)(cq + p.cq_off.head);
+  u->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+  u->cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+  u->pending = 0;
+
+  return TRUE;
+}
+
+/*
+ * queue one request, it goes to the kernel with the next `uring_enter()`
+ * */
+struct io_uring_sqe* uring_sqe(struct Uring* u, int op, int fd, uint64_t data) {
+
+  unsigned tail = *u->sq_tail;
+  unsigned i = tail & u->sq_mask;
+  struct io_uring_sqe* e = &u->sqes[i];
+
+  memset(e, 0, sizeof(*e));
+  e->opcode = op;
+  e->fd = fd;
+  e->user_data = data;
+  u->sq_array[i] = i;
+  atomic_store_explicit((_Atomic unsigned*)u->sq_tail, tail + 1, memory_order_release);
+  u->pending++;
+
+  return e;
+}
+
+void uring_read(struct Uring* u, struct Job* j, uint64_t data) {
+
+  if (j->len == j->cap) {
+    job_grow(j);
+  }
+
+  struct io_uring_sqe* e = uring_sqe(u, IORING_OP_READ, j->fd, data);
+  e->addr = (uint64_t)(uintptr_t)(j->buf + j->len);
+  e->len = j->cap - j->len;
+  e->off = j->len;
+}
+
+void uring_close(struct Uring* u, struct Job* j) {
+  uring_sqe(u, IORING_OP_CLOSE, j->fd, URING_CLOSE);
+  j->done = TRUE;
+}
+
+/*
+ * submit what is queued, and wait for a completion if `wait`
+ * */
+void uring_enter(struct Uring* u, boolean wait) {
+
+  if (u->pending == 0 && !wait) {
+    return;
+  }
+
+  int rc = syscall(__NR_io_uring_enter, u->fd, u->pending, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  if (rc >= 0) {
+    u->pending -= (unsigned)rc < u->pending ? (unsigned)rc : u->pending;
+  }
+}
+
+/*
+ * move every job that has a completion on to its next request:
+ * an open is followed by reads until one comes back empty, then a close;
+ * a short read is not the end of a pipe
+ * */
+void uring_reap(struct Loader* ld) {
+
+  struct Uring* u = &ld->ring;
+  unsigned head = *u->cq_head;
+  unsigned tail = atomic_load_explicit((_Atomic unsigned*)u->cq_tail, memory_order_acquire);
+
+  for (; head != tail; head++) {
+    struct io_uring_cqe* c = &u->cqes[head & u->cq_mask];
+    struct Job* j;
+
+    if (c->user_data == URING_CLOSE) {
+      continue;
+    }
+
+    j = &ld->job[c->user_data];
+    if (c->res < 0) {
+      j->err = -c->res;
+      if (j->fd < 0) {
+        j->done = TRUE;
+      }
+      else {
+        uring_close(u, j);
+      }
+    }
+    else if (j->fd < 0) {
+      j->fd = c->res;
+      uring_read(u, j, c->user_data);
+    }
+    else {
+      j->len += c->res;
+      if (c->res > 0) {
+        uring_read(u, j, c->user_data);
+      }
+      else {
+        uring_close(u, j);
+      }
+    }
+  }
+
+  atomic_store_explicit((_Atomic unsigned*)u->cq_head, head, memory_order_release);
+}
+#endif
+
+/*
+ * the fallback: open, read and close `j` with blocking calls
+ * */
+void job_read(struct Job* j) {
+
+  j->fd = open(j->name, O_RDONLY);
+  if (j->fd < 0) {
+    j->err = errno;
+    return;
+  }
+
+  for (;;) {
+    if (j->len == j->cap) {
+      job_grow(j);
+    }
+
+    long n = read(j->fd, j->buf + j->len, j->cap - j->len);
+    if (n < 0) {
+      j->err = errno;
+      break;
+    }
+    if (n == 0) {
+      break;
+    }
+    j->len += n;
+  }
+
+  close(j->fd);
+}
+
+void* loader_worker(void* arg) {
+
+  struct Loader* ld = (struct Loader*)arg;
+
+  pthread_mutex_lock(&ld->mu);
+  for (;;) {
+    while (ld->started < ld->n && ld->started >= ld->next + LOAD_DEPTH) {
+      pthread_cond_wait(&ld->cv, &ld->mu);
+    }
+    if (ld->started == ld->n) {
+      break;
+    }
+
+    struct Job* j = &ld->job[ld->started++];
+
+    if (j->cached) {
+      continue;
+    }
+
+    pthread_mutex_unlock(&ld->mu);
+    job_read(j);
+    pthread_mutex_lock(&ld->mu);
+
+    j->done = TRUE;
+    pthread_cond_broadcast(&ld->cv);
+  }
+  pthread_mutex_unlock(&ld->mu);
+
+  return NULL;
+}
+
+/*
+ * read the `n` files in `name`, with io_uring unless `threads`
+ * or the kernel does not have it
+ * */
+void loader_init(struct Loader* ld, char** name, long n, boolean threads) {
+
+  ld->job = (struct Job*)calloc(n, sizeof(struct Job));
+  ld->n = n;
+  ld->next = 0;
+  ld->started = 0;
+
+  for (long i = 0; i < n; i++) {
+    struct CacheEntry* e = cache_find(name[i]);
+
+    ld->job[i].name = name[i];
+    ld->job[i].fd = -1;
+    if (e != NULL) {
+      ld->job[i].buf = e->buf;
+      ld->job[i].len = e->len;
+      ld->job[i].done = TRUE;
+      ld->job[i].cached = TRUE;
+    }
+  }
+
+#ifdef __NR_io_uring_setup
+  ld->uring = !threads && uring_init(&ld->ring, 2 * LOAD_DEPTH);
+#else
+  ld->uring = FALSE;
+#endif
+
+  if (!ld->uring) {
+    pthread_mutex_init(&ld->mu, NULL);
+    pthread_cond_init(&ld->cv, NULL);
+    for (int i = 0; i < LOAD_THREADS; i++) {
+      pthread_create(&ld->pool[i], NULL, loader_worker, ld);
+    }
+  }
+}
+
+/*
+ * wait for the next file in order, `NULL` after the last
+ * give it back with `loader_done()`
+ * */
+struct Job* loader_next(struct Loader* ld) {
+
+  if (ld->next == ld->n) {
+    return NULL;
+  }
+
+  struct Job* j = &ld->job[ld->next];
+
+#ifdef __NR_io_uring_setup
+  if (ld->uring) {
+    for (; ld->started < ld->n && ld->started < ld->next + LOAD_DEPTH; ld->started++) {
+      if (ld->job[ld->started].cached) {
+        continue;
+      }
+
+      struct io_uring_sqe* e = uring_sqe(&ld->ring, IORING_OP_OPENAT, AT_FDCWD, ld->started);
+      e->addr = (uint64_t)(uintptr_t)ld->job[ld->started].name;
+      e->open_flags = O_RDONLY;
+    }
+
+    uring_reap(ld);
+    while (!j->done) {
+      uring_enter(&ld->ring, TRUE);
+      uring_reap(ld);
+    }
+    uring_enter(&ld->ring, FALSE);
+
+    ld->next++;
+    return j;
+  }
+#endif
+
+  pthread_mutex_lock(&ld->mu);
+  while (!j->done) {
+    pthread_cond_wait(&ld->cv, &ld->mu);
+  }
+  pthread_mutex_unlock(&ld->mu);
+
+  ld->next++;
+  return j;
+}
+
+void loader_done(struct Loader* ld, struct Job* j) {
+
+  if (!j->cached) {
+    free(j->buf);
+  }
+  j->buf = NULL;
+
+  if (!ld->uring) {
+    // the window moved on
+    pthread_mutex_lock(&ld->mu);
+    pthread_cond_broadcast(&ld->cv);
+    pthread_mutex_unlock(&ld->mu);
+  }
+}
+
+void loader_free(struct Loader* ld) {
+
+  if (ld->uring) {
+#ifdef __NR_io_uring_setup
+    close(ld->ring.fd);
+#endif
+  }
+  else {
+    for (int i = 0; i < LOAD_THREADS; i++) {
+      pthread_join(ld->pool[i], NULL);
+    }
+  }
+
+  free(ld->job);
+}
+
+/*
+ * lex `fp` as `main()` lexes one file, inflating it if it is gzip, or list
+ * its includes if `deps`, and leave the `print_answer()` numbers in
+ * `n_line` and `n`; return `EXIT_FAILURE` if its gzip data was bad
+ * */
+int lex_stream(FILE* fp, const char* name, unsigned only, boolean deps, boolean skip_if0, boolean utf8, boolean indexed,
+               const char* prog, int* n_line, int* n) {
+
+  FILE* in = fp;
+
+  *n_line = 0;
+  set(n, NTYPES, 0);
+  gz_input(&fp, prog, name);
+
+  if (deps) {
+    scan_deps(fp);
+  }
+  else if (indexed) {
+    index_lex(fp, only, utf8, prog, name, n_line, n);
+  }
+  else {
+    struct Lexer lx;
+    lex_init(&lx, fp, only, print_token, NULL);
+    lx.db.utf8 = utf8;
+    lx.skip_if0 = skip_if0;
+    lex_run(&lx);
+
+    if (lx.db.bad_utf8 != -1) {
+      fprintf(stderr, "%s: %s: invalid UTF-8 at byte %ld\n", prog, name, lx.db.bad_utf8);
+    }
+    print_answer(lex_lines(&lx), lx.n, NTYPES);
+    *n_line = lex_lines(&lx);
+    memcpy(n, lx.n, sizeof(lx.n));
+    lex_free(&lx);
+  }
+
+  // closing the inflating `FILE` tells whether the gzip data was good
+  if (fp != in && fclose(fp) != 0) {
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/*
+ * lex each of the `n` files in `name` as `main()` lexes one, each
+ * output after a `==> name <==` line; a file that cannot be read is
+ * reported and skipped, return `EXIT_FAILURE` if there was one
+ * */
+int lex_files(char** name, long n, unsigned only, boolean deps, boolean skip_if0, boolean utf8, boolean indexed, boolean threads, const char* prog) {
+
+  struct Loader ld;
+  struct Job* j;
+  int status = EXIT_SUCCESS;
+
+  loader_init(&ld, name, n, threads);
+
+  while ((j = loader_next(&ld)) != NULL) {
+    if (j->err != 0) {
+      printf("%s: cannot open %s\n", prog, j->name);
+      status = EXIT_FAILURE;
+      loader_done(&ld, j);
+      continue;
+    }
+
+    printf("==> %s <==\n", j->name);
+
+    FILE* fp = fmemopen(j->buf, j->len, "r");
+    int n_line;
+    int count[NTYPES];
+
+    if (lex_stream(fp, j->name, only, deps, skip_if0, utf8, indexed, prog, &n_line, count) != EXIT_SUCCESS) {
+      status = EXIT_FAILURE;
+    }
+    fclose(fp);
+    loader_done(&ld, j);
+  }
+
+  loader_free(&ld);
+  return status;
+}
+
+/*
+ * the `--include` and `--exclude` globs of `-r` and `--tar`
+ * */
+struct Filter {
+  char** include;
+  int n_include;
+  char** exclude;
+  int n_exclude;
+};
+
+/*
+ * a file is taken if its base name matches an `--include`, if there is
+ * any, and no `--exclude`; a directory is walked if it matches no `--exclude`
+ * */
+boolean filter_wanted(const struct Filter* f, const char* name, boolean dir) {
+
+  const char* base = strrchr(name, '/');
+  base = base != NULL ? base + 1 : name;
+
+  for (int i = 0; i < f->n_exclude; i++) {
+    if (fnmatch(f->exclude[i], base, 0) == 0) {
+      return FALSE;
+    }
+  }
+
+  if (dir || f->n_include == 0) {
+    return TRUE;
+  }
+
+  for (int i = 0; i < f->n_include; i++) {
+    if (fnmatch(f->include[i], base, 0) == 0) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/*
+ * the directories `-r` has yet to read and the files it has found,
+ * shared by the walker threads and the lexer
+ * */
+struct Walk {
+  pthread_mutex_t mu;
+  pthread_cond_t cv;
+  char** dir;
+  long n_dir;
+  long cap_dir;
+  char** file;
+  long head;
+  long tail;
+  long cap_file;
+  int busy;
+  char** bad;
+  long n_bad;
+  long cap_bad;
+  const struct Filter* filter;
+};
+
+#define WALK_THREADS 8
+
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+/*
+ * with `mu` held
+ * */
+void walk_push(char*** a, long* n, long* cap, char* s) {
+
+  if (*n == *cap) {
+    *cap = *cap == 0 ? 0x100 : 2 * *cap;
+    *a = (char**)realloc(*a, *cap * sizeof(char*));
+  }
+  (*a)[(*n)++] = s;
+}
+
+/*
+ * a directory that could not be read, for `walk_report()`
+ * */
+void walk_fail(struct Walk* w, char* path) {
+  pthread_mutex_lock(&w->mu);
+  walk_push(&w->bad, &w->n_bad, &w->cap_bad, path);
+  pthread_mutex_unlock(&w->mu);
+}
+
+/*
+ * read the directory `path` with `getdents64`, queueing what is in it
+ * */
+void walk_dir(struct Walk* w, char* path) {
+
+  int fd = openat(AT_FDCWD, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  char buf[0x8000];
+  long n;
+
+  if (fd < 0) {
+    walk_fail(w, path);
+    return;
+  }
+
+  while ((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+    for (long i = 0; i < n; ) {
+      struct linux_dirent64* e = (struct linux_dirent64*)(buf + i);
+      int type = e->d_type;
+      i += e->d_reclen;
+
+      if (e->d_name[0] == '.' && (e->d_name[1] == '\0' || (e->d_name[1] == '.' && e->d_name[2] == '\0'))) {
+        continue;
+      }
+
+      if (type == DT_UNKNOWN) {
+        struct stat st;
+        if (fstatat(fd, e->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+          continue;
+        }
+        type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+      }
+
+      if ((type != DT_DIR && type != DT_REG) || !filter_wanted(w->filter, e->d_name, type == DT_DIR)) {
+        continue;
+      }
+
+      char* sub = (char*)malloc(strlen(path) + strlen(e->d_name) + 2);
+      sprintf(sub, "%s/%s", path, e->d_name);
+
+      pthread_mutex_lock(&w->mu);
+      if (type == DT_DIR) {
+        walk_push(&w->dir, &w->n_dir, &w->cap_dir, sub);
+      }
+      else {
+        walk_push(&w->file, &w->tail, &w->cap_file, sub);
+      }
+      pthread_cond_broadcast(&w->cv);
+      pthread_mutex_unlock(&w->mu);
+    }
+  }
+
+  close(fd);
+  if (n < 0) {
+    walk_fail(w, path);
+  }
+  else {
+    free(path);
+  }
+}
+
+void* walk_worker(void* arg) {
+
+  struct Walk* w = (struct Walk*)arg;
+
+  pthread_mutex_lock(&w->mu);
+  for (;;) {
+    while (w->n_dir == 0 && w->busy > 0) {
+      pthread_cond_wait(&w->cv, &w->mu);
+    }
+    if (w->n_dir == 0) {
+      break;
+    }
+
+    char* path = w->dir[--w->n_dir];
+    w->busy++;
+    pthread_mutex_unlock(&w->mu);
+
+    walk_dir(w, path);
+
+    pthread_mutex_lock(&w->mu);
+    w->busy--;
+    pthread_cond_broadcast(&w->cv);
+  }
+  pthread_mutex_unlock(&w->mu);
+
+  return NULL;
+}
+
+/*
+ * the next file found, `NULL` once the walk is over
+ * */
+char* walk_next(struct Walk* w) {
+
+  char* path = NULL;
+
+  pthread_mutex_lock(&w->mu);
+  while (w->head == w->tail && (w->n_dir > 0 || w->busy > 0)) {
+    pthread_cond_wait(&w->cv, &w->mu);
+  }
+  if (w->head < w->tail) {
+    path = w->file[w->head++];
+  }
+  pthread_mutex_unlock(&w->mu);
+
+  return path;
+}
+
+/*
+ * print the directories that could not be read since the last call,
+ * from the thread that prints the rest; return `TRUE` if there were any
+ * */
+boolean walk_report(struct Walk* w, const char* prog) {
+
+  boolean any;
+
+  pthread_mutex_lock(&w->mu);
+  any = w->n_bad > 0;
+  for (long i = 0; i < w->n_bad; i++) {
+    printf("%s: cannot read directory %s\n", prog, w->bad[i]);
+    free(w->bad[i]);
+  }
+  w->n_bad = 0;
+  pthread_mutex_unlock(&w->mu);
+
+  return any;
+}
+
+/*
+ * `-r DIR`: lex the files under `root` as `lex_files()` does, while
+ * `WALK_THREADS` threads are still looking for more, then print the
+ * counts of all of them under `==> total <==`
+ * */
+int lex_tree(const char* root, const struct Filter* filter, unsigned only, boolean deps, boolean skip_if0, boolean utf8, boolean indexed, const char* prog) {
+
+  struct Walk w;
+  pthread_t pool[WALK_THREADS];
+  int total_line = 0;
+  int total[NTYPES] = { 0 };
+  int status = EXIT_SUCCESS;
+  char* path;
+  int fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  if (fd < 0) {
+    printf("%s: cannot open %s\n", prog, root);
+    return EXIT_FAILURE;
+  }
+  close(fd);
+
+  memset(&w, 0, sizeof(w));
+  pthread_mutex_init(&w.mu, NULL);
+  pthread_cond_init(&w.cv, NULL);
+  w.filter = filter;
+  walk_push(&w.dir, &w.n_dir, &w.cap_dir, strdup(root));
+
+  for (int i = 0; i < WALK_THREADS; i++) {
+    pthread_create(&pool[i], NULL, walk_worker, &w);
+  }
+
+  while ((path = walk_next(&w)) != NULL) {
+    FILE* fp = open_input(path);
+    int n_line;
+    int n[NTYPES];
+
+    if (walk_report(&w, prog)) {
+      status = EXIT_FAILURE;
+    }
+
+    if (fp == NULL) {
+      printf("%s: cannot open %s\n", prog, path);
+      status = EXIT_FAILURE;
+    }
+    else {
+      printf("==> %s <==\n", path);
+      if (lex_stream(fp, path, only, deps, skip_if0, utf8, indexed, prog, &n_line, n) != EXIT_SUCCESS) {
+        status = EXIT_FAILURE;
+      }
+      fclose(fp);
+
+      total_line += n_line;
+      for (int i = 0; i < NTYPES; i++) {
+        total[i] += n[i];
+      }
+    }
+    free(path);
+  }
+
+  for (int i = 0; i < WALK_THREADS; i++) {
+    pthread_join(pool[i], NULL);
+  }
+  if (walk_report(&w, prog)) {
+    status = EXIT_FAILURE;
+  }
+
+  if (!deps) {
+    printf("==> total <==\n");
+    print_answer(total_line, total, NTYPES);
+  }
+
+  free(w.dir);
+  free(w.file);
+  free(w.bad);
+  return status;
+}
+
+/*
+ * `--bundle=FILE`: lex each member of the bundle `path`, see `bundle.h`,
+ * as `lex_files()` lexes each file, straight from a mapping of it
+ * */
+int lex_bundle(const char* path, unsigned only, boolean deps, boolean skip_if0, boolean utf8, boolean indexed, const char* prog) {
+
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    printf("%s: cannot open %s\n", prog, path);
+    exit(EXIT_FAILURE);
+  }
+
+  char* mem = st.st_size > 0 ? (char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : (char*)MAP_FAILED;
+  uint64_t size = st.st_size;
+  struct BundleHeader* h = (struct BundleHeader*)mem;
+
+  close(fd);
+  if (mem == MAP_FAILED || size < sizeof(*h) || memcmp(h->magic, BUNDLE_MAGIC, 8) != 0
+      || h->index > size || h->index % BUNDLE_ALIGN != 0
+      || h->n > (size - h->index) / sizeof(struct BundleEntry)) {
+    printf("%s: %s is not a bundle\n", prog, path);
+    exit(EXIT_FAILURE);
+  }
+  madvise(mem, size, MADV_SEQUENTIAL);
+
+  struct BundleEntry* e = (struct BundleEntry*)(mem + h->index);
+  char* names = (char*)(e + h->n);
+  uint64_t len_names = mem + size - names;
+  int status = EXIT_SUCCESS;
+
+  for (uint64_t i = 0; i < h->n; i++, e++) {
+    if (e->offset > size || e->len > size - e->offset || (uint64_t)e->name + e->name_len > len_names) {
+      printf("%s: %s: member %lu is broken\n", prog, path, (unsigned long)i);
+      status = EXIT_FAILURE;
+      continue;
+    }
+
+    printf("==> %.*s <==\n", (int)e->name_len, names + e->name);
+
+    char name[PATH_MAX];
+    snprintf(name, sizeof(name), "%.*s", (int)e->name_len, names + e->name);
+
+    FILE* fp = fmemopen(mem + e->offset, e->len, "r");
+    int n_line;
+    int n[NTYPES];
+
+    if (lex_stream(fp, name, only, deps, skip_if0, utf8, indexed, prog, &n_line, n) != EXIT_SUCCESS) {
+      status = EXIT_FAILURE;
+    }
+    fclose(fp);
+  }
+
+  munmap(mem, size);
+  return status;
+}
+
+#define TAR_BLOCK 512
+#define TAR_RUN 0x100000
+
+/*
+ * what the extended headers say about the member that follows them
+ * */
+struct TarState {
+  char name[PATH_MAX];
+  boolean has_name;
+};
+
+/*
+ * a number field, octal or, for large sizes, base-256
+ * */
+uint64_t tar_number(const char* p, int len) {
+
+  uint64_t v = 0;
+
+  if ((unsigned char)p[0] & 0x80) {
+    v = (unsigned char)p[0] & 0x7f;
+    for (int i = 1; i < len; i++) {
+      v = v << 8 | (unsigned char)p[i];
+    }
+    return v;
+  }
+
+  for (int i = 0; i < len && p[i] != '\0' && p[i] != ' '; i++) {
+    if (p[i] >= '0' && p[i] <= '7') {
+      v = v * 8 + p[i] - '0';
+    }
+  }
+
+  return v;
+}
+
+/*
+ * read the header block `h`: return -1 at the end of the archive or if it
+ * is not a header, else the type, with `name` and `size` of the member
+ * */
+int tar_header(struct TarState* st, const char* h, char* name, uint64_t* size) {
+
+  long sum = 0;
+
+  for (int i = 0; i < TAR_BLOCK; i++) {
+    sum += i >= 148 && i < 156 ? ' ' : (unsigned char)h[i];
+  }
+  if (h[0] == '\0' || sum != (long)tar_number(h + 148, 8)) {
+    return -1;
+  }
+
+  *size = tar_number(h + 124, 12);
+
+  if (st->has_name) {
+    snprintf(name, PATH_MAX, "%s", st->name);
+    st->has_name = FALSE;
+  }
+  else if (memcmp(h + 257, "ustar", 5) == 0 && h[345] != '\0') {
+    snprintf(name, PATH_MAX, "%.155s/%.100s", h + 345, h);
+  }
+  else {
+    snprintf(name, PATH_MAX, "%.100s", h);
+  }
+
+  return h[156] == '\0' ? '0' : h[156];
+}
+
+/*
+ * an archive ends with two blocks of zeros
+ * */
+boolean tar_zero(const char* h) {
+  for (int i = 0; i < TAR_BLOCK; i++) {
+    if (h[i] != '\0') {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+/*
+ * take the name of the next member from a GNU long name, `L`, or a pax
+ * header, `x`, of `len` bytes at `p`
+ * */
+void tar_meta(struct TarState* st, int type, const char* p, uint64_t len) {
+
+  if (type == 'L') {
+    snprintf(st->name, sizeof(st->name), "%.*s", (int)(len < PATH_MAX ? len : PATH_MAX - 1), p);
+    st->has_name = TRUE;
+    return;
+  }
+
+  // records are "LEN key=value\n"
+  for (uint64_t i = 0; i < len; ) {
+    char* end;
+    long l = strtol(p + i, &end, 10);
+
+    if (l <= 0 || i + l > len) {
+      break;
+    }
+    if (strncmp(end, " path=", 6) == 0) {
+      int n = p + i + l - 1 - (end + 6);
+      snprintf(st->name, sizeof(st->name), "%.*s", n, end + 6);
+      st->has_name = TRUE;
+    }
+    i += l;
+  }
+}
+
+/*
+ * a member of a seekable archive, at `offset` in the mapping
+ * */
+struct TarMember {
+  char* name;
+  uint64_t offset;
+  uint64_t size;
+};
+
+/*
+ * lex `m[0..n)` from the mapping `mem`, as `lex_files()` lexes each file
+ * */
+int tar_lex_members(const char* mem, struct TarMember* m, long n, unsigned only, boolean deps, boolean skip_if0,
+                    boolean utf8, boolean indexed, const char* prog) {
+
+  int status = EXIT_SUCCESS;
+
+  for (long i = 0; i < n; i++) {
+    FILE* fp = fmemopen((char*)mem + m[i].offset, m[i].size, "r");
+    int n_line;
+    int count[NTYPES];
+
+    printf("==> %s <==\n", m[i].name);
+    if (lex_stream(fp, m[i].name, only, deps, skip_if0, utf8, indexed, prog, &n_line, count) != EXIT_SUCCESS) {
+      status = EXIT_FAILURE;
+    }
+    fclose(fp);
+  }
+
+  return status;
+}
+
+/*
+ * a seekable archive is mapped and its members are cut into runs of about
+ * `TAR_RUN` bytes; up to one run per CPU is lexed at a time, each in a
+ * child process writing to its own pipe, and the pipes are copied out in
+ * order, so the output comes in archive order and a run that gets ahead
+ * waits on its pipe instead of piling up its output
+ * */
+int tar_mapped(int fd, uint64_t size, const struct Filter* filter, unsigned only, boolean deps, boolean skip_if0,
+               boolean utf8, boolean indexed, const char* prog) {
+
+  char* mem = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  struct TarState st = { "", FALSE };
+  struct TarMember* m = NULL;
+  long n = 0;
+  long cap = 0;
+  boolean ended = FALSE;
+  int status = EXIT_SUCCESS;
+
+  if (mem == MAP_FAILED) {
+    return -1;
+  }
+  madvise(mem, size, MADV_WILLNEED);
+
+  for (uint64_t p = 0; p + TAR_BLOCK <= size; ) {
+    char name[PATH_MAX];
+    uint64_t len;
+    int type = tar_header(&st, mem + p, name, &len);
+
+    if (type == -1) {
+      ended = p + 2 * TAR_BLOCK <= size && tar_zero(mem + p) && tar_zero(mem + p + TAR_BLOCK);
+      break;
+    }
+    p += TAR_BLOCK;
+    if (len > size - p) {
+      break;
+    }
+
+    if (type == 'L' || type == 'x') {
+      tar_meta(&st, type, mem + p, len);
+    }
+    else if ((type == '0' || type == '7') && filter_wanted(filter, name, FALSE)) {
+      if (n == cap) {
+        cap = cap == 0 ? 0x100 : 2 * cap;
+        m = (struct TarMember*)realloc(m, cap * sizeof(struct TarMember));
+      }
+      m[n].name = strdup(name);
+      m[n].offset = p;
+      m[n].size = len;
+      n++;
+    }
+
+    p += (len + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+  }
+
+  if (!ended) {
+    printf("%s: truncated archive\n", prog);
+    status = EXIT_FAILURE;
+  }
+
+  long workers = sysconf(_SC_NPROCESSORS_ONLN);
+  workers = workers < 1 ? 1 : workers > n ? n : workers;
+
+  if (workers <= 1) {
+    if (tar_lex_members(mem, m, n, only, deps, skip_if0, utf8, indexed, prog) != EXIT_SUCCESS) {
+      status = EXIT_FAILURE;
+    }
+  }
+  else {
+    int out[workers];
+    pid_t pid[workers];
+    long first = 0;
+    long head = 0;      // runs started
+    long tail = 0;      // runs copied out
+    char buf[0x10000];
+
+    fflush(stdout);
+    while (first < n || tail < head) {
+      while (first < n && head - tail < workers) {
+        long last = first;
+        uint64_t len = 0;
+        int p[2];
+
+        while (last < n && (last == first || len + m[last].size <= TAR_RUN)) {
+          len += m[last++].size;
+        }
+
+        if (pipe(p) != 0) {
+          printf("%s: cannot make a pipe: %s\n", prog, strerror(errno));
+          status = EXIT_FAILURE;
+          first = n;
+          break;
+        }
+        fcntl(p[0], F_SETPIPE_SZ, TAR_RUN);
+
+        fflush(stdout);
+        pid[head % workers] = fork();
+        if (pid[head % workers] == 0) {
+          // `_exit()`, or the `on_exit()` of `--serve` would answer for the parent
+          close(p[0]);
+          dup2(p[1], 1);
+          close(p[1]);
+          int st = tar_lex_members(mem, m + first, last - first, only, deps, skip_if0, utf8, indexed, prog);
+          fflush(stdout);
+          fflush(stderr);
+          _exit(st);
+        }
+        close(p[1]);
+        if (pid[head % workers] < 0) {
+          printf("%s: cannot fork: %s\n", prog, strerror(errno));
+          close(p[0]);
+          status = EXIT_FAILURE;
+          first = n;
+          break;
+        }
+        out[head % workers] = p[0];
+        head++;
+        first = last;
+      }
+
+      if (tail == head) {
+        break;
+      }
+
+      int k = tail % workers;
+      int ws;
+      ssize_t got;
+
+      while ((got = read(out[k], buf, sizeof(buf))) > 0) {
+        fwrite(buf, 1, got, stdout);
+      }
+      close(out[k]);
+
+      if (waitpid(pid[k], &ws, 0) != pid[k] || !WIFEXITED(ws) || WEXITSTATUS(ws) != EXIT_SUCCESS) {
+        status = EXIT_FAILURE;
+      }
+      tail++;
+    }
+  }
+
+  for (long i = 0; i < n; i++) {
+    free(m[i].name);
+  }
+  free(m);
+  munmap(mem, size);
+
+  return status;
+}
+
+/*
+ * `--tar=FILE`: lex each regular member of the tar archive `path` that
+ * passes `filter`, its output after a `==> member <==` line
+ * an archive that cannot be mapped, a pipe or gzip, is read through once
+ * */
+int lex_tar(const char* path, const struct Filter* filter, unsigned only, boolean deps, boolean skip_if0,
+            boolean utf8, boolean indexed, const char* prog) {
+
+  int fd = strcmp(path, "-") == 0 ? dup(0) : open(path, O_RDONLY);
+  struct stat sb;
+  unsigned char magic[2];
+
+  if (fd < 0 || fstat(fd, &sb) != 0) {
+    printf("%s: cannot open %s\n", prog, path);
+    exit(EXIT_FAILURE);
+  }
+
+  if (S_ISREG(sb.st_mode) && sb.st_size > 0 && pread(fd, magic, 2, 0) == 2 && !is_gzip((char*)magic, 2)) {
+    int status = tar_mapped(fd, sb.st_size, filter, only, deps, skip_if0, utf8, indexed, prog);
+    if (status != -1) {
+      close(fd);
+      return status;
+    }
+  }
+
+  gzFile gz = gzdopen(fd, "rb");
+  struct TarState st = { "", FALSE };
+  char h[TAR_BLOCK];
+  char* buf = NULL;
+  uint64_t cap = 0;
+  boolean ended = FALSE;
+  int status = EXIT_SUCCESS;
+
+  while (gzread(gz, h, TAR_BLOCK) == TAR_BLOCK) {
+    char name[PATH_MAX];
+    uint64_t len;
+    int type = tar_header(&st, h, name, &len);
+
+    if (type == -1) {
+      ended = tar_zero(h) && gzread(gz, h, TAR_BLOCK) == TAR_BLOCK && tar_zero(h);
+      break;
+    }
+
+    uint64_t padded = (len + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+    if (padded > cap) {
+      cap = padded;
+      buf = (char*)realloc(buf, cap);
+    }
+    if (padded > 0 && gzread(gz, buf, padded) != (int)padded) {
+      break;
+    }
+
+    if (type == 'L' || type == 'x') {
+      tar_meta(&st, type, buf, len);
+    }
+    else if ((type == '0' || type == '7') && filter_wanted(filter, name, FALSE)) {
+      struct TarMember m = { name, 0, len };
+      if (tar_lex_members(buf, &m, 1, only, deps, skip_if0, utf8, indexed, prog) != EXIT_SUCCESS) {
+        status = EXIT_FAILURE;
+      }
+    }
+  }
+
+  if (!ended) {
+    printf("%s: truncated archive\n", prog);
+    status = EXIT_FAILURE;
+  }
+
+  gzclose(gz);
+  free(buf);
+  return status;
+}
+
+/*
+ * `--shm=NAME`: read the input `path` into the shared object `NAME`,
+ * inflating it if it is gzip, then lex it into the token ring there,
+ * see `tokring.h`; the consumer unlinks the object
+ * */
+int lex_shared(const char* name, const char* path, unsigned only, boolean skip_if0, boolean utf8, const char* prog) {
+
+  int in = strcmp(path, "-") == 0 ? dup(0) : open(path, O_RDONLY);
+  gzFile gz = in < 0 ? NULL : gzdopen(in, "rb");
+  struct stat sb;
+
+  if (gz == NULL || fstat(in, &sb) != 0) {
+    printf("%s: cannot open %s\n", prog, path);
+    exit(EXIT_FAILURE);
+  }
+
+  shm_unlink(name);
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+  if (fd < 0) {
+    printf("%s: cannot create %s\n", prog, name);
+    exit(EXIT_FAILURE);
+  }
+
+  uint64_t records = (sizeof(struct TokRing) + PAD - 1) / PAD * PAD;
+  uint64_t source = records + TOKRING_SLOTS * sizeof(struct TokRecord);
+  uint64_t cap = S_ISREG(sb.st_mode) && sb.st_size > 0 ? sb.st_size : 0x100000;
+  uint64_t n = 0;
+  int got;
+
+  // one byte more than a plain file, to see its end without growing
+  cap++;
+  if (ftruncate(fd, source + cap) != 0) {
+    printf("%s: cannot size %s\n", prog, name);
+    exit(EXIT_FAILURE);
+  }
+  char* map = (char*)mmap(NULL, source + cap, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  while ((got = gzread(gz, map + source + n, cap - n < 0x40000000 ? cap - n : 0x40000000)) > 0) {
+    n += got;
+    if (n == cap) {
+      if (ftruncate(fd, source + 2 * cap) != 0) {
+        printf("%s: cannot size %s\n", prog, name);
+        exit(EXIT_FAILURE);
+      }
+      map = (char*)mremap(map, source + cap, source + 2 * cap, MREMAP_MAYMOVE);
+      cap *= 2;
+    }
+  }
+  if (got < 0) {
+    printf("%s: %s: corrupt gzip data\n", prog, path);
+    exit(EXIT_FAILURE);
+  }
+  gzclose(gz);
+
+  struct TokRing* r = (struct TokRing*)map;
+  uint64_t magic;
+
+  r->slots = TOKRING_SLOTS;
+  r->n_types = NTYPES;
+  for (int i = 0; i < NTYPES; i++) {
+    strncpy(r->names[i], token_name(i), TOKRING_NAME_MAX);
+  }
+  r->records = records;
+  r->source = source;
+  r->source_len = n;
+  memcpy(&magic, TOKRING_MAGIC, sizeof(magic));
+  __atomic_store_n((uint64_t*)r->magic, magic, __ATOMIC_RELEASE);
+
+  struct TokWriter w = { r, (struct TokRecord*)(map + records), 0 };
+  struct Lexer lx;
+  FILE* fp = NULL;
+
+  // `--skip-if0` reads ahead through a `FILE`, else the bytes are fed as they are
+  if (skip_if0) {
+    fp = n > 0 ? fmemopen(map + source, n, "r") : fopen("/dev/null", "r");
+  }
+  lex_init(&lx, fp, only, print_token, NULL);
+  lex_share(&lx, &w);
+  lx.db.utf8 = utf8;
+  lx.skip_if0 = skip_if0;
+
+  if (fp != NULL) {
+    lex_run(&lx);
+    fclose(fp);
+  }
+  else {
+    lex_feed(&lx, map + source, n);
+    lex_finish(&lx);
+  }
+
+  tokring_publish(&w);
+  r->n_line = lex_lines(&lx);
+  __atomic_store_n(&r->done, 1, __ATOMIC_SEQ_CST);
+  tokring_wake(&r->readable, &r->reader_waits, TRUE);
+
+  if (lx.db.bad_utf8 != -1) {
+    fprintf(stderr, "%s: %s: invalid UTF-8 at byte %ld\n", prog, path, lx.db.bad_utf8);
+  }
+  print_answer(lex_lines(&lx), lx.n, NTYPES);
+  lex_free(&lx);
+  munmap(map, source + cap);
+  close(fd);
+
+  return EXIT_SUCCESS;
+}
+
+#define WATCH_BUCKETS 0x4000
+
+/*
+ * what `--watch` keeps of a file: the `print_answer()` counts and a hash
+ * of the contents, so a write that changes nothing is not reported
+ * */
+struct Summary {
+  char* path;
+  int n_line;
+  int n[NTYPES];
+  uint64_t hash;
+  int seen;            // the last `Watch.scan` that found it
+  struct Summary* next;
+};
+
+/*
+ * the files and the watched directories of `--watch`, by path and by
+ * watch descriptor
+ * */
+struct Watch {
+  int fd;
+  int scan;
+  struct Summary* file[WATCH_BUCKETS];
+  char** dir;
+  int n_dir;
+};
+
+struct Summary** watch_slot(struct Watch* w, const char* path) {
+
+  struct Summary** e = &w->file[hash_str(path) % WATCH_BUCKETS];
+
+  while (*e != NULL && strcmp((*e)->path, path) != 0) {
+    e = &(*e)->next;
+  }
+
+  return e;
+}
+
+/*
+ * `+` for a new file, `~` for a changed one, `-` for one that is gone,
+ * then the path and, but for `-`, the lines, the counts and the hash
+ * */
+void watch_print(char op, struct Summary* s) {
+
+  printf("%c %s", op, s->path);
+
+  if (op != '-') {
+    printf(" %d", s->n_line);
+    for (int i = 0; i < NTYPES; i++) {
+      printf(" %d", s->n[i]);
+    }
+    printf(" %016llx", (unsigned long long)s->hash);
+  }
+
+  printf("\n");
+}
+
+boolean watch_wanted(const char* name) {
+
+  const char* dot = strrchr(name, '.');
+
+  return name[0] != '.' && dot != NULL && (strcmp(dot, ".c") == 0 || strcmp(dot, ".h") == 0);
+}
+
+/*
+ * lex `path` again and report it if it changed
+ * */
+void watch_file(struct Watch* w, const char* path) {
+
+  FILE* fp = fopen(path, "r");
+  if (fp == NULL) {
+    return;
+  }
+
+  long len;
+  char* buf = load_file(fp, &len);
+  fclose(fp);
+
+  uint64_t h = hash_bytes(buf, len);
+  struct Summary** slot = watch_slot(w, path);
+  struct Summary* s = *slot;
+  char op = '~';
+
+  if (s == NULL) {
+    s = (struct Summary*)calloc(1, sizeof(struct Summary));
+    s->path = strdup(path);
+    *slot = s;
+    op = '+';
+  }
+  s->seen = w->scan;
+  if (op == '~' && s->hash == h) {
+    free(buf);
+    return;
+  }
+
+  struct Lexer lx;
+  fp = fmemopen(buf, len, "r");
+  lex_init(&lx, fp, 0, NULL, NULL);
+  lex_run(&lx);
+  fclose(fp);
+
+  s->n_line = lex_lines(&lx);
+  memcpy(s->n, lx.n, sizeof(s->n));
+  s->hash = h;
+  lex_free(&lx);
+  free(buf);
+
+  watch_print(op, s);
+}
+
+/*
+ * forget the file `path`, or every file under it if it is a directory
+ * */
+void watch_forget(struct Watch* w, const char* path, boolean dir) {
+
+  int l = strlen(path);
+
+  for (int i = 0; i < WATCH_BUCKETS; i++) {
+    struct Summary** e = &w->file[i];
+
+    while (*e != NULL) {
+      struct Summary* s = *e;
+
+      if (dir ? strncmp(s->path, path, l) == 0 && s->path[l] == '/' : strcmp(s->path, path) == 0) {
+        watch_print('-', s);
+        *e = s->next;
+        free(s->path);
+        free(s);
+      }
+      else {
+        e = &s->next;
+      }
+    }
+  }
+
+  if (!dir) {
+    return;
+  }
+
+  for (int i = 0; i < w->n_dir; i++) {
+    if (w->dir[i] != NULL && strncmp(w->dir[i], path, l) == 0 && (w->dir[i][l] == '/' || w->dir[i][l] == '\0')) {
+      inotify_rm_watch(w->fd, i);
+      free(w->dir[i]);
+      w->dir[i] = NULL;
+    }
+  }
+}
+
+/*
+ * watch the directory `path` and lex the files under it
+ * */
+void watch_dir(struct Watch* w, const char* path) {
+
+  int wd = inotify_add_watch(w->fd, path, IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR);
+  if (wd < 0) {
+    return;
+  }
+
+  if (wd >= w->n_dir) {
+    int n = 2 * wd + 16;
+    w->dir = (char**)realloc(w->dir, n * sizeof(char*));
+    memset(w->dir + w->n_dir, 0, (n - w->n_dir) * sizeof(char*));
+    w->n_dir = n;
+  }
+  free(w->dir[wd]);
+  w->dir[wd] = strdup(path);
+
+  DIR* d = opendir(path);
+  struct dirent* e;
+
+  if (d == NULL) {
+    return;
+  }
+
+  while ((e = readdir(d)) != NULL) {
+    char sub[PATH_MAX];
+
+    if (e->d_name[0] == '.') {
+      continue;
+    }
+    snprintf(sub, sizeof(sub), "%s/%s", path, e->d_name);
+
+    struct stat st;
+    if (lstat(sub, &st) != 0) {
+      continue;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      watch_dir(w, sub);
+    }
+    else if (S_ISREG(st.st_mode) && watch_wanted(e->d_name)) {
+      watch_file(w, sub);
+    }
+  }
+
+  closedir(d);
+}
+
+/*
+ * the kernel dropped events: walk `root` again, report what changed and
+ * what is gone, and drop the watches of directories no longer under it
+ * */
+void watch_rescan(struct Watch* w, const char* root) {
+
+  char** old = w->dir;
+  int n_old = w->n_dir;
 
-  int l = db_get_len(db);
-  
-  if (l == BUF_SIZE) {
-    printf("%d <ERROR,", n_line);
-    db_ptok(db, l);
-    printf(">\n");
-    db_move(db, l);
-    set(len, NELEMS(len), 0);
-    return;
+  w->dir = (char**)calloc(n_old, sizeof(char*));
+  w->scan++;
+  watch_dir(w, root);
+
+  for (int i = 0; i < n_old; i++) {
+    if (old[i] != NULL && (i >= w->n_dir || w->dir[i] == NULL)) {
+      inotify_rm_watch(w->fd, i);
+    }
+    free(old[i]);
   }
+  free(old);
 
-  for (int i = 0; i < n; i++) {
-    if (rv[i] == PARSE_SUCCESS) {
-      len[i] = l;
+  for (int i = 0; i < WATCH_BUCKETS; i++) {
+    struct Summary** e = &w->file[i];
+
+    while (*e != NULL) {
+      struct Summary* s = *e;
+
+      if (s->seen != w->scan) {
+        watch_print('-', s);
+        *e = s->next;
+        free(s->path);
+        free(s);
+      }
+      else {
+        e = &s->next;
+      }
     }
   }
 }
 
-void print_answer(int n_line, int* n, int len) {
+/*
+ * `--watch=DIR`: lex the `.c` and `.h` files under `DIR`, print a `+` line
+ * for each, then follow inotify and print a line for each file that
+ * changes, see `watch_print()`
+ * */
+int watch(const char* root, const char* prog) {
 
-  printf("%d\n", n_line);
+  struct Watch w;
 
-  for (int i = 0; i < len - 1; i++) {
-    printf("%d ", n[i]);
+  memset(&w, 0, sizeof(w));
+  w.fd = inotify_init1(IN_CLOEXEC);
+  if (w.fd < 0) {
+    printf("%s: cannot watch %s\n", prog, root);
+    exit(EXIT_FAILURE);
   }
 
-  printf("\n%d\n", n[len - 1]);
+  watch_dir(&w, root);
+  if (w.n_dir == 0) {
+    printf("%s: cannot watch %s\n", prog, root);
+    exit(EXIT_FAILURE);
+  }
+  fflush(stdout);
+
+  char buf[0x10000] __attribute__((aligned(__alignof__(struct inotify_event))));
+  long n;
+
+  while ((n = read(w.fd, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR)) {
+    for (char* p = buf; p < buf + n; ) {
+      struct inotify_event* ev = (struct inotify_event*)p;
+      p += sizeof(struct inotify_event) + ev->len;
+
+      // an overflow comes with no watch and no name
+      if (ev->mask & IN_Q_OVERFLOW) {
+        watch_rescan(&w, root);
+        continue;
+      }
+      if (ev->len == 0 || ev->wd < 0 || ev->wd >= w.n_dir || w.dir[ev->wd] == NULL || ev->name[0] == '.') {
+        continue;
+      }
+
+      char path[PATH_MAX];
+      snprintf(path, sizeof(path), "%s/%s", w.dir[ev->wd], ev->name);
+
+      if (ev->mask & IN_ISDIR) {
+        if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+          watch_dir(&w, path);
+        }
+        else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+          watch_forget(&w, path, TRUE);
+        }
+      }
+      else if (watch_wanted(ev->name)) {
+        if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+          watch_file(&w, path);
+        }
+        else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+          watch_forget(&w, path, FALSE);
+        }
+      }
+    }
+
+    fflush(stdout);
+  }
+
+  return EXIT_FAILURE;
 }
 
-int main(int argc, char* argv[])
-{
-  if (argc < 2) {
-    printf("Usage: %s <filename>\n", argv[0]);
+/*
+ * a request of `--client` is a `uint32_t` length, sent along with the
+ * client's stdin, stdout and stderr, then that many bytes: the working
+ * directory and the command line, each ended by '\0'
+ * the reply is one byte, the exit status
+ * */
+#define SERVE_MAX_REQUEST 0x100000
+
+int main(int argc, char* argv[]);
+
+int serve_listen(const char* path, const char* prog, boolean bind_it) {
+
+  struct sockaddr_un addr;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (fd < 0 || strlen(path) >= sizeof(addr.sun_path)) {
+    printf("%s: bad socket %s\n", prog, path);
     exit(EXIT_FAILURE);
   }
+  strcpy(addr.sun_path, path);
 
-  FILE* fp = fopen(argv[1], "r");
-  
-  if (fp == NULL) {
-    printf("%s: cannot open %s\n", argv[0], argv[1]);
+  if (!bind_it) {
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  unlink(path);
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+    printf("%s: cannot listen on %s\n", prog, path);
     exit(EXIT_FAILURE);
   }
 
-  struct DoubleBuffer db;
-  db_init(&db, fp);
+  return fd;
+}
 
-  int n_line = 1;
-  int n[NTYPES] = { 0 };
-  int len[NTYPES + 1] = { 0 };
-  boolean in_cmt = FALSE;
+/*
+ * the `on_exit()` of a request, however `main()` ends
+ * */
+void serve_reply(int status, void* arg) {
 
-  char c;
-  boolean rst = TRUE;
-  enum ParseResult rv[NTYPES + 1];
+  unsigned char b = status;
+
+  fflush(stdout);
+  fflush(stderr);
+  write((int)(intptr_t)arg, &b, 1);
+}
+
+/*
+ * a connection of `--serve`, handed to its own thread
+ * */
+struct ServeJob {
+  int conn;
+  int listener;
+};
+
+/*
+ * read one request from the connection and fork a child that runs
+ * `main()` on it with the client's descriptors; this thread first brings
+ * the cache up to date with the files named, and the child lexes them
+ * from there, so the accept loop never waits on a read
+ * */
+void* serve_request(void* arg) {
+
+  struct ServeJob* job = (struct ServeJob*)arg;
+  int conn = job->conn;
+  int listener = job->listener;
+  uint32_t len;
+  int fds[3];
+  char ctl[CMSG_SPACE(sizeof(fds))];
+  struct iovec v = { &len, sizeof(len) };
+  struct msghdr msg;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &v;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctl;
+  msg.msg_controllen = sizeof(ctl);
+
+  free(job);
+
+  struct cmsghdr* c = recvmsg(conn, &msg, 0) == sizeof(len) ? CMSG_FIRSTHDR(&msg) : NULL;
+  if (c == NULL || c->cmsg_type != SCM_RIGHTS || c->cmsg_len != CMSG_LEN(sizeof(fds))) {
+    close(conn);
+    return NULL;
+  }
+  memcpy(fds, CMSG_DATA(c), sizeof(fds));
+
+  char* req = len <= SERVE_MAX_REQUEST ? (char*)malloc(len + 1) : NULL;
+  long got = 0;
+  long n;
+
+  while (req != NULL && got < len && (n = read(conn, req + got, len - got)) > 0) {
+    got += n;
+  }
+
+  char* argv[0x1000];
+  int argc = 0;
+
+  // the working directory is the whole process's, so only the child enters `req`
+  if (req != NULL && got == len && len > 0 && req[len - 1] == '\0' && req[0] == '/') {
+    for (char* p = req + strlen(req) + 1; p < req + len && argc < (int)NELEMS(argv) - 1; p += strlen(p) + 1) {
+      argv[argc++] = p;
+    }
+    argv[argc] = NULL;
+
+    for (int i = 1; i < argc; i++) {
+      if (argv[i][0] != '-') {
+        cache_load(req, argv[i]);
+      }
+    }
+  }
+
+  if (argc == 0) {
+    unsigned char b = EXIT_FAILURE;
+    write(conn, &b, 1);
+  }
+  else {
+    // the child gets the cache as no other request is changing it
+    pthread_mutex_lock(&cache_mu);
+    pid_t pid = fork();
+    pthread_mutex_unlock(&cache_mu);
+
+    if (pid == 0) {
+      close(listener);
+      for (int i = 0; i < 3; i++) {
+        dup2(fds[i], i);
+      }
+      on_exit(serve_reply, (void*)(intptr_t)conn);
+      if (chdir(req) != 0) {
+        exit(EXIT_FAILURE);
+      }
+      signal(SIGCHLD, SIG_DFL);
+      optind = 0;
+      exit(main(argc, argv));
+    }
+  }
+
+  for (int i = 0; i < 3; i++) {
+    close(fds[i]);
+  }
+  free(req);
+  close(conn);
+  return NULL;
+}
+
+/*
+ * `--serve=PATH`: answer `--client` requests until killed
+ * each request gets a thread that forks the child lexing it, so it starts
+ * with the keyword trie built and the cache filled
+ * */
+int serve(const char* path, const char* prog) {
+
+  int fd = serve_listen(path, prog, FALSE);
+
+  if (fd != -1) {
+    printf("%s: %s is already served\n", prog, path);
+    exit(EXIT_FAILURE);
+  }
+
+  fd = serve_listen(path, prog, TRUE);
+  signal(SIGCHLD, SIG_IGN);
+  pthread_once(&keyword_once, keyword_init);
 
   for (;;) {
-    c = db_getc(&db);
-    parse(c, rst, rv, NELEMS(rv));
-    rst = FALSE;
+    int conn = accept(fd, NULL, NULL);
+    pthread_t t;
+
+    if (conn >= 0) {
+      struct ServeJob* job = (struct ServeJob*)malloc(sizeof(struct ServeJob));
+      job->conn = conn;
+      job->listener = fd;
+      if (pthread_create(&t, NULL, serve_request, job) != 0) {
+        free(job);
+        close(conn);
+        continue;
+      }
+      pthread_detach(t);
+    }
+  }
+}
 
-    if (all(rv, NELEMS(rv), PARSE_END)) {
-      int i = max_idx(len, NELEMS(len));
+/*
+ * `lex --client=PATH ...`: run `lex ...` in the server at `PATH`
+ * */
+int client(const char* path, int argc, char** argv) {
 
-      if (i != -1) {
-        if (i != NTYPES) {
-          printf("%d <%s,", n_line, token_name(i));
-          db_ptok(&db, len[i]);
-          printf(">\n");
-          n[i]++;
-        }
+  int fd = serve_listen(path, argv[0], FALSE);
 
-        if (c == '\n') {
-          n_line--; // skip '\n'
-        }
+  if (fd == -1) {
+    printf("%s: cannot connect to %s\n", argv[0], path);
+    exit(EXIT_FAILURE);
+  }
+
+  char cwd[PATH_MAX];
+  if (getcwd(cwd, sizeof(cwd)) == NULL) {
+    printf("%s: cannot get the working directory\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  uint32_t len = strlen(cwd) + 1;
+  for (int i = 0; i < argc; i++) {
+    len += strlen(argv[i]) + 1;
+  }
+
+  int fds[3] = { 0, 1, 2 };
+  char ctl[CMSG_SPACE(sizeof(fds))];
+  struct iovec v = { &len, sizeof(len) };
+  struct msghdr msg;
+
+  memset(&msg, 0, sizeof(msg));
+  memset(ctl, 0, sizeof(ctl));
+  msg.msg_iov = &v;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctl;
+  msg.msg_controllen = sizeof(ctl);
+
+  struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  c->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(c), fds, sizeof(fds));
+
+  if (sendmsg(fd, &msg, 0) != sizeof(len)) {
+    printf("%s: cannot send to %s\n", argv[0], path);
+    exit(EXIT_FAILURE);
+  }
+
+  FILE* out = fdopen(fd, "w");
+  fwrite(cwd, 1, strlen(cwd) + 1, out);
+  for (int i = 0; i < argc; i++) {
+    fwrite(argv[i], 1, strlen(argv[i]) + 1, out);
+  }
+  fflush(out);
+
+  unsigned char b;
+  if (read(fd, &b, 1) != 1) {
+    return EXIT_FAILURE;
+  }
+
+  return b;
+}
+
+int main(int argc, char* argv[])
+{
+  static const struct option long_opts[] = {
+    { "only", required_argument, NULL, 'o' },
+    { "deps", no_argument, NULL, 'd' },
+    { "skip-if0", no_argument, NULL, 'z' },
+    { "utf8", no_argument, NULL, 'u' },
+    { "engine", required_argument, NULL, 'e' },
+    { "checkpoints", required_argument, NULL, 'k' },
+    { "range", required_argument, NULL, 'R' },
+    { "resume", no_argument, NULL, 'K' },
+    { "pipeline", no_argument, NULL, 'p' },
+    { "io", required_argument, NULL, 'i' },
+    { "count", no_argument, NULL, 'c' },
+    { "serve", required_argument, NULL, 'S' },
+    { "watch", required_argument, NULL, 'w' },
+    { "include", required_argument, NULL, 'I' },
+    { "exclude", required_argument, NULL, 'X' },
+    { "bundle", required_argument, NULL, 'b' },
+    { "tar", required_argument, NULL, 't' },
+    { "shm", required_argument, NULL, 'm' },
+    { "tokens", required_argument, NULL, 'T' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  // the rest of the command line is run by the server
+  if (argc > 1 && strncmp(argv[1], "--client=", 9) == 0) {
+    const char* path = argv[1] + 9;
+    argv[1] = argv[0];
+    return client(path, argc - 1, argv + 1);
+  }
 
-        db_move(&db, len[i]);
+  unsigned only = ~0u;
+  boolean deps = FALSE;
+  boolean skip_if0 = FALSE;
+  boolean utf8 = FALSE;
+  boolean indexed = FALSE;
+  long every = 0;
+  long from = -1;
+  long to = LONG_MAX;
+  boolean resume = FALSE;
+  boolean pipelined = FALSE;
+  boolean threads = FALSE;
+  const char* serve_path = NULL;
+  const char* watch_root = NULL;
+  const char* tree = NULL;
+  const char* bundle = NULL;
+  const char* tar = NULL;
+  const char* shm = NULL;
+  const char* tokens = NULL;
+  struct Filter filter = { (char**)malloc(argc * sizeof(char*)), 0, (char**)malloc(argc * sizeof(char*)), 0 };
+  int opt;
+
+  while ((opt = getopt_long(argc, argv, "r:", long_opts, NULL)) != -1) {
+    switch (opt) {
+      case 'o':
+        only = parse_only(argv[0], optarg);
+        break;
+      case 'd':
+        deps = TRUE;
+        break;
+      case 'z':
+        skip_if0 = TRUE;
+        break;
+      case 'u':
+        utf8 = TRUE;
+        break;
+      case 'e':
+        if (strcmp(optarg, "index") == 0) {
+          indexed = TRUE;
+        }
+        else if (strcmp(optarg, "loop") != 0) {
+          printf("%s: unknown engine %s\n", argv[0], optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'k':
+        every = atol(optarg) * 1024;
+        if (every <= 0) {
+          printf("%s: bad checkpoint interval %s\n", argv[0], optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'R': {
+        char* end;
+        from = strtol(optarg, &end, 10);
+        if (end == optarg || *end != '-' || from < 0) {
+          printf("%s: bad range %s\n", argv[0], optarg);
+          exit(EXIT_FAILURE);
+        }
+        if (*++end != '\0') {
+          to = strtol(end, &end, 10);
+        }
+        if (*end != '\0' || to < from) {
+          printf("%s: bad range %s\n", argv[0], optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
       }
-      else {
-        if (c == EOF) {
-          print_answer(n_line, n, NELEMS(n));
-          exit(EXIT_SUCCESS);
+      case 'K':
+        resume = TRUE;
+        break;
+      case 'p':
+        pipelined = TRUE;
+        break;
+      case 'c':
+        only = 0;
+        break;
+      case 'S':
+        serve_path = optarg;
+        break;
+      case 'w':
+        watch_root = optarg;
+        break;
+      case 'r':
+        tree = optarg;
+        break;
+      case 'b':
+        bundle = optarg;
+        break;
+      case 't':
+        tar = optarg;
+        break;
+      case 'm':
+        shm = optarg;
+        break;
+      case 'T':
+        tokens = optarg;
+        break;
+      case 'I':
+        filter.include[filter.n_include++] = optarg;
+        break;
+      case 'X':
+        filter.exclude[filter.n_exclude++] = optarg;
+        break;
+      case 'i':
+        if (strcmp(optarg, "threads") == 0) {
+          threads = TRUE;
+        }
+        else if (strcmp(optarg, "uring") != 0) {
+          printf("%s: unknown io %s\n", argv[0], optarg);
+          exit(EXIT_FAILURE);
         }
+        break;
+      default:
+        exit(EXIT_FAILURE);
+    }
+  }
 
-        db_move(&db, 1);
-      }
+  if (serve_path != NULL) {
+    return serve(serve_path, argv[0]);
+  }
+
+  if (watch_root != NULL) {
+    return watch(watch_root, argv[0]);
+  }
 
-      set(len, NELEMS(len), 0);
-      rst = TRUE;
-      in_cmt = FALSE;
+  if (tree != NULL || bundle != NULL || tar != NULL) {
+    if (optind < argc || every != 0 || from != -1 || resume || pipelined || tokens != NULL || shm != NULL
+        || (tree != NULL) + (bundle != NULL) + (tar != NULL) > 1) {
+      printf("%s: -r, --bundle and --tar take no other files, checkpoint options, --pipeline, --tokens or --shm\n", argv[0]);
+      exit(EXIT_FAILURE);
     }
-    else if (in_cmt) {
-      db_move(&db, 1);
+    if (utf8) {
+      parser[1] = utf8_identifier_parser;
+    }
+    if (bundle != NULL) {
+      return lex_bundle(bundle, only, deps, skip_if0, utf8, indexed, argv[0]);
+    }
+    if (tar != NULL) {
+      return lex_tar(tar, &filter, only, deps, skip_if0, utf8, indexed, argv[0]);
+    }
+    return lex_tree(tree, &filter, only, deps, skip_if0, utf8, indexed, argv[0]);
+  }
+
+  if (optind >= argc) {
+    printf("Usage: %s [--client=SOCKET] [--only=TYPE[,TYPE]|--count] [--deps] [--skip-if0] [--utf8]\n"
+           "          [--engine=loop|index] [--checkpoints=KB] [--range=FROM-[TO]] [--resume] [--pipeline]\n"
+           "          [--io=uring|threads] [--tokens=FILE] <filename>...\n"
+           "       %s [--only=TYPE[,TYPE]] [--skip-if0] [--utf8] --shm=NAME <filename>\n"
+           "       %s [options] -r DIR [--include=GLOB]... [--exclude=GLOB]...\n"
+           "       %s [options] --bundle=FILE\n"
+           "       %s [options] --tar=FILE [--include=GLOB]... [--exclude=GLOB]...\n"
+           "       %s --serve=SOCKET\n"
+           "       %s --watch=DIR\n", argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (indexed && skip_if0) {
+    printf("%s: --skip-if0 needs --engine=loop\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  boolean sidecar = every != 0 || from != -1 || resume;
+
+  if (sidecar && (indexed || skip_if0 || strcmp(argv[optind], "-") == 0)) {
+    printf("%s: --checkpoints, --range and --resume need a file, --engine=loop and no --skip-if0\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (pipelined && (indexed || skip_if0 || sidecar)) {
+    printf("%s: --pipeline goes with none of --engine=index, --skip-if0 and the checkpoint options\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (from != -1 && (resume || every != 0)) {
+    printf("%s: --range goes with neither --resume nor --checkpoints\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (argc - optind > 1 && (sidecar || pipelined)) {
+    printf("%s: the checkpoint options and --pipeline take one file\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (shm != NULL && (deps || indexed || sidecar || pipelined || argc - optind > 1)) {
+    printf("%s: --shm takes one file and none of --deps, --engine=index, --pipeline and the checkpoint options\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (tokens != NULL && (deps || indexed || shm != NULL || argc - optind > 1)) {
+    printf("%s: --tokens takes one file and none of --deps, --engine=index and --shm\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (utf8) {
+    parser[1] = utf8_identifier_parser;
+  }
+
+  if (shm != NULL) {
+    return lex_shared(shm, argv[optind], only, skip_if0, utf8, argv[0]);
+  }
+
+  if (argc - optind > 1) {
+    return lex_files(argv + optind, argc - optind, only, deps, skip_if0, utf8, indexed, threads, argv[0]);
+  }
+
+  FILE* fp = strcmp(argv[optind], "-") == 0 ? stdin : open_input(argv[optind]);
+  
+  if (fp == NULL) {
+    printf("%s: cannot open %s\n", argv[0], argv[optind]);
+    exit(EXIT_FAILURE);
+  }
+
+  // `gz_input()` swaps `fp` for an inflating `FILE`, which fails to close on bad gzip data
+  FILE* in = fp;
+
+  // a pipe is fed in whatever chunks `read()` returns
+  boolean push = strcmp(argv[optind], "-") == 0 && !skip_if0 && !deps && !indexed;
+  char first[0x10000];
+  long first_len = 0;
+  boolean gz = FALSE;
+  boolean inflating = FALSE;
+
+  if (push) {
+    while ((first_len = read(fileno(fp), first, sizeof(first))) < 0 && errno == EINTR) {
+    }
+    if (first_len < 0) {
+      printf("%s: cannot read %s: %s\n", argv[0], argv[optind], strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    gz = is_gzip(first, first_len);
+  }
+  else if (fileno(fp) >= 0 && pread(fileno(fp), first, 2, 0) == 2) {
+    gz = is_gzip(first, 2);
+  }
+  else if (!pipelined) {
+    // a cached file or a pipe is looked at, and inflated, through the `FILE`;
+    // the reader of `--pipeline` sees for itself
+    gz = inflating = gz_input(&fp, argv[0], argv[optind]);
+  }
+
+  if (gz && sidecar) {
+    printf("%s: gzip input goes with none of the checkpoint options\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  // gzip is inflated by the reader thread of `--pipeline`, unless the
+  // whole of it is wanted in a `FILE`
+  if (gz && !inflating) {
+    if (deps || indexed || skip_if0) {
+      gz_input(&fp, argv[0], argv[optind]);
     }
     else {
-      update_len(rv, len, NELEMS(rv), &db, n_line);
+      pipelined = TRUE;
+    }
+  }
 
-      if (all(rv, NELEMS(rv) - 1, PARSE_END)) {
-        db_move(&db, len[NELEMS(rv) - 1]);
-        set(len, NELEMS(len), 0);
-        in_cmt = TRUE;
-      }
+  if (deps) {
+    scan_deps(fp);
+    exit(fp != in && fclose(fp) != 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+  }
+
+  if (indexed) {
+    index_lex(fp, only, utf8, argv[0], argv[optind], NULL, NULL);
+    exit(fp != in && fclose(fp) != 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+  }
+
+  struct Lexer lx;
+  struct Pipeline pl;
+
+  if (pipelined) {
+    lex_init(&lx, NULL, only, pipe_token, &pl);
+  }
+  else {
+    lex_init(&lx, push ? NULL : fp, only, print_token, NULL);
+  }
+  lx.db.utf8 = utf8;
+  lx.skip_if0 = skip_if0;
+
+  struct TokEncoder enc;
+
+  if (tokens != NULL) {
+    FILE* out = fopen(tokens, "wb");
+
+    if (out == NULL) {
+      printf("%s: cannot create %s\n", argv[0], tokens);
+      exit(EXIT_FAILURE);
     }
+    tokenc_init(&enc, out);
+    lex_encode(&lx, &enc);
+  }
+
+  FILE* ckpt = NULL;
+
+  if (sidecar) {
+    ckpt = open_sidecar(&lx, argv[0], argv[optind], every, from, to, resume);
+  }
 
-    if (c == '\n') {
-      n_line++;
+  if (pipelined) {
+    pipe_run(&pl, &lx, fp, argv[0], argv[optind], first, first_len);
+  }
+  else if (push) {
+    char chunk[0x10000];
+    long n;
+
+    if (first_len > 0) {
+      lex_feed(&lx, first, first_len);
+    }
+    while ((n = read(fileno(fp), chunk, sizeof(chunk))) > 0 || (n < 0 && errno == EINTR)) {
+      if (n > 0) {
+        lex_feed(&lx, chunk, n);
+      }
     }
+    if (n < 0) {
+      printf("%s: cannot read %s: %s\n", argv[0], argv[optind], strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    lex_finish(&lx);
+  }
+  else {
+    lex_run(&lx);
+  }
+
+  if (lx.db.bad_utf8 != -1) {
+    fprintf(stderr, "%s: %s: invalid UTF-8 at byte %ld\n", argv[0], argv[optind], lx.db.bad_utf8);
+  }
+  // a range stops short of what has been read
+  print_answer(to == LONG_MAX ? lex_lines(&lx) : lex_line(&lx, lx.db.pos), lx.n, NTYPES);
+  lex_free(&lx);
+
+  if (ckpt != NULL) {
+    fclose(ckpt);
+  }
+
+  if (tokens != NULL && tokenc_close(&enc) != 0) {
+    printf("%s: cannot write %s\n", argv[0], tokens);
+    exit(EXIT_FAILURE);
+  }
+
+  if ((pipelined && pl.bad) || (fp != in && fclose(fp) != 0)) {
+    return EXIT_FAILURE;
   }
 
   return EXIT_SUCCESS;
 }
-
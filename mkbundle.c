@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bundle.h"
+
+/*
+ * pack source files into one bundle for `lex --bundle`, see `bundle.h`
+ *
+ * usage: mkbundle OUT [FILE]...
+ * with no FILE, the names are read from stdin, one per line, so that
+ * `find . -name '*.h' | mkbundle out.lexb` works
+ * */
+
+static struct BundleEntry* entry;
+static char* names;
+static uint64_t n_entry = 0;
+static uint64_t cap_entry = 0;
+static uint32_t len_names = 0;
+static uint32_t cap_names = 0;
+
+void add(FILE* out, const char* name, uint64_t* offset) {
+
+  FILE* fp = fopen(name, "rb");
+  char buf[0x10000];
+  size_t n;
+  uint32_t l = strlen(name);
+
+  if (fp == NULL) {
+    fprintf(stderr, "mkbundle: cannot open %s\n", name);
+    exit(EXIT_FAILURE);
+  }
+
+  if (n_entry == cap_entry) {
+    cap_entry = cap_entry == 0 ? 0x400 : 2 * cap_entry;
+    entry = (struct BundleEntry*)realloc(entry, cap_entry * sizeof(struct BundleEntry));
+  }
+  while (len_names + l > cap_names) {
+    cap_names = cap_names == 0 ? 0x10000 : 2 * cap_names;
+    names = (char*)realloc(names, cap_names);
+  }
+
+  struct BundleEntry* e = &entry[n_entry++];
+  e->offset = *offset;
+  e->len = 0;
+  e->name = len_names;
+  e->name_len = l;
+  memcpy(names + len_names, name, l);
+  len_names += l;
+
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    fwrite(buf, 1, n, out);
+    e->len += n;
+  }
+
+  if (ferror(fp)) {
+    fprintf(stderr, "mkbundle: cannot read %s\n", name);
+    exit(EXIT_FAILURE);
+  }
+  fclose(fp);
+  *offset += e->len;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <bundle> [filename]...\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  FILE* out = fopen(argv[1], "wb");
+  if (out == NULL) {
+    fprintf(stderr, "mkbundle: cannot open %s\n", argv[1]);
+    exit(EXIT_FAILURE);
+  }
+
+  struct BundleHeader h;
+  uint64_t offset = sizeof(h);
+
+  // the header is written again once the index is known
+  memset(&h, 0, sizeof(h));
+  fwrite(&h, sizeof(h), 1, out);
+
+  if (argc > 2) {
+    for (int i = 2; i < argc; i++) {
+      add(out, argv[i], &offset);
+    }
+  }
+  else {
+    char line[4096];
+
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+      line[strcspn(line, "\n")] = '\0';
+      if (line[0] != '\0') {
+        add(out, line, &offset);
+      }
+    }
+  }
+
+  // the entries are read in place, so they must be aligned
+  static const char pad[BUNDLE_ALIGN];
+  uint64_t n_pad = (BUNDLE_ALIGN - offset % BUNDLE_ALIGN) % BUNDLE_ALIGN;
+
+  fwrite(pad, 1, n_pad, out);
+  offset += n_pad;
+
+  fwrite(entry, sizeof(struct BundleEntry), n_entry, out);
+  fwrite(names, 1, len_names, out);
+
+  memcpy(h.magic, BUNDLE_MAGIC, 8);
+  h.n = n_entry;
+  h.index = offset;
+  rewind(out);
+  fwrite(&h, sizeof(h), 1, out);
+
+  // a failed `fwrite()` of a member shows up here
+  int err = ferror(out);
+
+  if (fclose(out) != 0 || err) {
+    fprintf(stderr, "mkbundle: cannot write %s\n", argv[1]);
+    exit(EXIT_FAILURE);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * generate `punct.h`, the operator and delimiter DFA used by `lex.c`
+ *
+ * every prefix of a punctuator is a state; state 0 is dead and state 1
+ * is the empty prefix, so one lookup per char gives the next state and
+ * the longest match is the last state that accepts
+ * */
+
+#define NELEMS(a) (sizeof(a) / sizeof(a[0]))
+#define MAX_STATES 128
+#define MAX_LEN 3
+
+typedef enum {
+  FALSE,
+  TRUE
+} boolean;
+
+static const char* operators[35] = {
+  "+", "-", "*", "/", "%", "++", "--",
+  "==", "!=", ">", "<", ">=", "<=",
+  "&&", "||", "!",
+  "&", "|", "^", "~", "<<", ">>",
+  "=", "+=", "-=", "*=", "/=", "%=", "<<=", ">>=", "&=", "^=", "|=",
+  ".", "->"
+};
+
+static const char* delimiters[10] = {
+  ";", ",", ":", "?",
+  "(", ")", "[", "]",
+  "{", "}"
+};
+
+enum Accept {
+  NONE,
+  OPERATOR,
+  DELIMITER
+};
+
+static char prefix[MAX_STATES][MAX_LEN + 1];
+static enum Accept accept[MAX_STATES];
+static int n_states = 2;
+
+/*
+ * return the state of prefix `s`, adding it if it is new
+ * */
+int state_of(const char* s) {
+
+  for (int i = 1; i < n_states; i++) {
+    if (strcmp(prefix[i], s) == 0) {
+      return i;
+    }
+  }
+
+  if (n_states == MAX_STATES) {
+    fprintf(stderr, "mkpunct: too many states\n");
+    exit(EXIT_FAILURE);
+  }
+
+  strcpy(prefix[n_states], s);
+  return n_states++;
+}
+
+void add(const char* s, enum Accept a) {
+
+  char p[MAX_LEN + 1];
+  int len = strlen(s);
+
+  if (len > MAX_LEN) {
+    fprintf(stderr, "mkpunct: %s is longer than %d chars\n", s, MAX_LEN);
+    exit(EXIT_FAILURE);
+  }
+
+  for (int i = 1; i <= len; i++) {
+    memcpy(p, s, i);
+    p[i] = '\0';
+    state_of(p);
+  }
+
+  accept[state_of(s)] = a;
+}
+
+int main(void)
+{
+  prefix[1][0] = '\0';
+
+  for (int i = 0; i < (int)NELEMS(operators); i++) {
+    add(operators[i], OPERATOR);
+  }
+  for (int i = 0; i < (int)NELEMS(delimiters); i++) {
+    add(delimiters[i], DELIMITER);
+  }
+
+  printf("/* generated by mkpunct, do not edit */\n\n");
+  printf("#define PUNCT_DEAD 0\n");
+  printf("#define PUNCT_START 1\n");
+  printf("#define PUNCT_MAX_LEN %d\n\n", MAX_LEN);
+  printf("enum PunctAccept {\n  PUNCT_NONE,\n  PUNCT_OPERATOR,\n  PUNCT_DELIMITER\n};\n\n");
+
+  printf("static const unsigned char punct_next[%d][256] = {\n", n_states);
+  for (int i = 1; i < n_states; i++) {
+    int len = strlen(prefix[i]);
+    boolean open = FALSE;
+
+    for (int j = 2; j < n_states; j++) {
+      if ((int)strlen(prefix[j]) == len + 1 && strncmp(prefix[j], prefix[i], len) == 0) {
+        if (!open) {
+          printf("  [%d] = {", i);
+          open = TRUE;
+        }
+        printf(" ['%c'] = %d,", prefix[j][len], j);
+      }
+    }
+
+    if (open) {
+      printf(" },\n");
+    }
+  }
+  printf("};\n\n");
+
+  printf("static const unsigned char punct_accept[%d] = {\n", n_states);
+  for (int i = 2; i < n_states; i++) {
+    if (accept[i] != NONE) {
+      printf("  [%d] = %s, /* %s */\n", i, accept[i] == OPERATOR ? "PUNCT_OPERATOR" : "PUNCT_DELIMITER", prefix[i]);
+    }
+  }
+  printf("};\n");
+
+  return EXIT_SUCCESS;
+}
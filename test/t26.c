@@ -0,0 +1,13 @@
+#include <stdio.h>
+  #  include "a.h" // x
+/* #include "no.h" */
+char* s = "#include <no.h>";
+char c = '"';
+int a = 3 / 2; // #include "no2.h"
+#if 1
+#include<b/c.h>
+#endif
+x # include "no3.h"
+/*
+*/ #include "d.h"
+/* a */ #include "e.h"
@@ -0,0 +1,26 @@
+int a;
+#if 0
+int dead1;
+# if FOO
+int dead2;
+# else
+int dead3;
+# endif
+  /* '#' in comment */ x # y
+#else
+int live1;
+#endif
+#if 1
+int live2;
+#ifdef BAR
+int live3;
+#endif
+#else
+int dead4;
+#if 0
+#else
+#endif
+#endif
+int last;
+#if 0
+int dead5;
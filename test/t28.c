@@ -0,0 +1,4 @@
+int 变量 = 1;
+char* é_x2 = "中文";
+double π2 = 6.28; // 注释
+int ａｂ, x̂;
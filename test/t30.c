@@ -0,0 +1,47 @@
+#if 0
+dead0;
+#elif 1
+live1;
+#elif X
+dead2;
+#else
+dead3;
+#endif
+#if 0
+dead4;
+#elif 0
+dead5;
+#elif X
+maybe6;
+#else
+maybe7;
+#endif
+#if 1
+live8;
+#elif 1
+dead9;
+#else
+dead10;
+#endif
+#if 0
+/* comment
+#else
+#endif */
+x = "#endif /*";
+c = '"';
+y = a / b; // #endif
+  // spliced \
+#endif
+/* a */ #else
+live11;
+#endif
+z;
+#if 0
+#error don't
+it's
+#endif
+ok;
+#if 0
+a /
+#endif
+b;
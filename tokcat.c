@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tokring.h"
+#include "tokstream.h"
+
+/*
+ * read the tokens of `lex --shm=NAME` from the ring, see `tokring.h`,
+ * or of `lex --tokens=FILE` from the file, see `tokstream.h`,
+ * and print them as lex prints them
+ *
+ * usage: tokcat NAME | tokcat -f FILE
+ * it may start before or after lex; the object is unlinked once mapped
+ * */
+
+static const char* names[8] = {
+  "KEYWORD", "IDENTIFIER", "OPERATOR", "DELIMITER",
+  "CHARCON", "STRING", "NUMBER", "ERROR"
+};
+
+int cat_file(const char* path) {
+
+  struct TokStream ts;
+  struct Token t;
+
+  if (tokstream_open(&ts, path) != 0) {
+    fprintf(stderr, "tokcat: %s is not a token stream\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  while (tokstream_next(&ts, &t)) {
+    printf("%d <%s,", t.line, t.type < 8 ? names[t.type] : "?");
+    fwrite(t.s, 1, t.s_len, stdout);
+    printf(">\n");
+  }
+
+  if (ts.error) {
+    fprintf(stderr, "tokcat: %s is corrupt or truncated\n", path);
+    exit(EXIT_FAILURE);
+  }
+  tokstream_close(&ts);
+
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+  struct TokReader rd;
+  struct TokRecord t;
+
+  if (argc == 3 && strcmp(argv[1], "-f") == 0) {
+    return cat_file(argv[2]);
+  }
+  if (argc != 2) {
+    fprintf(stderr, "usage: tokcat NAME | tokcat -f FILE\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (tokring_open(&rd, argv[1]) != 0) {
+    fprintf(stderr, "tokcat: cannot map %s\n", argv[1]);
+    exit(EXIT_FAILURE);
+  }
+  shm_unlink(argv[1]);
+
+  while (tokring_next(&rd, &t)) {
+    const char* s = rd.source + t.offset;
+
+    printf("%u <%s,", t.line, rd.r->names[t.type]);
+    // the lexeme as it is in the source, less its backslash-newlines
+    for (uint32_t k = 0; k < t.len; k++) {
+      if (s[k] == '\\' && k + 1 < t.len && s[k + 1] == '\n') {
+        k++;
+      }
+      else {
+        putchar(s[k]);
+      }
+    }
+    printf(">\n");
+  }
+
+  return EXIT_SUCCESS;
+}
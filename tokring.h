@@ -0,0 +1,174 @@
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/*
+ * the `--shm=NAME` token ring, shared with a consumer on the same machine
+ *
+ * the object `/dev/shm/NAME` holds a `struct TokRing`, `slots` token
+ * records at `records` and the whole input at `source`; a record gives
+ * the lexeme by its offset and length in the source, backslash-newlines
+ * included, so nothing is copied or formatted
+ *
+ * lex writes `magic` last, once the source is in place; the consumer
+ * waits for it with `tokring_open()` and reads with `tokring_next()`
+ * both sides count records in `head` and `tail`, which wrap; one sleeps
+ * on the other's futex word only after setting its `..._waits` flag
+ * */
+
+#define TOKRING_MAGIC "lexring1"
+#define TOKRING_SLOTS 0x10000
+#define TOKRING_BATCH 0x100
+#define TOKRING_NAME_MAX 16
+
+struct TokRecord {
+  uint64_t offset;
+  uint32_t len;
+  uint32_t line;
+  uint32_t type;
+  uint32_t reserved;
+};
+
+struct TokRing {
+  char magic[8];
+  uint32_t slots;
+  uint32_t n_types;
+  char names[8][TOKRING_NAME_MAX];
+  uint64_t records;
+  uint64_t source;
+  uint64_t source_len;
+  uint32_t n_line;       // once `done`
+  uint32_t done;
+
+  // written by lex
+  uint32_t head __attribute__((aligned(64)));
+  uint32_t readable;     // bumped to wake the consumer
+  uint32_t writer_waits;
+
+  // written by the consumer
+  uint32_t tail __attribute__((aligned(64)));
+  uint32_t writable;     // bumped to wake lex
+  uint32_t reader_waits;
+};
+
+static inline void tokring_wait(uint32_t* word, uint32_t seen) {
+  syscall(SYS_futex, word, FUTEX_WAIT, seen, NULL, NULL, 0);
+}
+
+/*
+ * wake whoever sleeps on `word`, if `waits` says someone might
+ * */
+static inline void tokring_wake(uint32_t* word, uint32_t* waits, int force) {
+  if (__atomic_exchange_n(waits, 0, __ATOMIC_SEQ_CST) || force) {
+    __atomic_fetch_add(word, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+  }
+}
+
+/*
+ * the consumer side: where it is, and what it has seen of `head`
+ * */
+struct TokReader {
+  struct TokRing* r;
+  const struct TokRecord* records;
+  const char* source;
+  uint32_t tail;
+  uint32_t head;
+};
+
+/*
+ * map the ring `name`, waiting for lex to create and fill it
+ * return -1 if it cannot be opened or mapped
+ * */
+static inline int tokring_open(struct TokReader* rd, const char* name) {
+
+  int fd = -1;
+  struct stat sb;
+
+  for (;;) {
+    if (fd < 0) {
+      fd = shm_open(name, O_RDWR, 0);
+    }
+    if (fd >= 0 && fstat(fd, &sb) == 0 && sb.st_size >= (off_t)sizeof(struct TokRing)) {
+      struct TokRing* r = (struct TokRing*)mmap(NULL, sizeof(struct TokRing), PROT_READ, MAP_SHARED, fd, 0);
+      uint64_t magic;
+
+      if (r == MAP_FAILED) {
+        close(fd);
+        return -1;
+      }
+      magic = __atomic_load_n((uint64_t*)r->magic, __ATOMIC_ACQUIRE);
+      munmap(r, sizeof(struct TokRing));
+
+      if (memcmp(&magic, TOKRING_MAGIC, 8) == 0) {
+        // the size is final by the time the magic is written
+        fstat(fd, &sb);
+        r = (struct TokRing*)mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (r == MAP_FAILED) {
+          return -1;
+        }
+        rd->r = r;
+        rd->records = (const struct TokRecord*)((char*)r + r->records);
+        rd->source = (char*)r + r->source;
+        rd->tail = rd->head = 0;
+        return 0;
+      }
+    }
+    usleep(1000);
+  }
+}
+
+/*
+ * hand the records read so far back to lex
+ * */
+static inline void tokring_release(struct TokReader* rd) {
+  __atomic_store_n(&rd->r->tail, rd->tail, __ATOMIC_SEQ_CST);
+  tokring_wake(&rd->r->writable, &rd->r->writer_waits, 0);
+}
+
+/*
+ * copy the next record to `t`, return 0 after the last
+ * */
+static inline int tokring_next(struct TokReader* rd, struct TokRecord* t) {
+
+  struct TokRing* r = rd->r;
+
+  while (rd->tail == rd->head) {
+    rd->head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    if (rd->tail != rd->head) {
+      break;
+    }
+
+    tokring_release(rd);
+
+    uint32_t seen = __atomic_load_n(&r->readable, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&r->reader_waits, 1, __ATOMIC_SEQ_CST);
+
+    // `head` is final once `done` is set
+    if (__atomic_load_n(&r->done, __ATOMIC_SEQ_CST)) {
+      rd->head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+      if (rd->tail == rd->head) {
+        return 0;
+      }
+      break;
+    }
+    if (__atomic_load_n(&r->head, __ATOMIC_SEQ_CST) == rd->tail) {
+      tokring_wait(&r->readable, seen);
+    }
+  }
+
+  *t = rd->records[rd->tail & (r->slots - 1)];
+
+  if ((++rd->tail & (TOKRING_BATCH - 1)) == 0) {
+    tokring_release(rd);
+  }
+
+  return 1;
+}
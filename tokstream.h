@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+/*
+ * the `--tokens=FILE` format, a compressed token stream
+ *
+ * `TOKSTREAM_MAGIC`, then blocks of at most `TOKSTREAM_BLOCK` tokens,
+ * then a block of none; a block is varints `n`, `raw_len` and
+ * `packed_len`, then `packed_len` bytes of zlib data that inflate to
+ * `raw_len` bytes: six columns, each led by its length in a varint
+ *
+ *   types    (type byte, run length varint) pairs
+ *   lines    line minus the line of the token before
+ *   gaps     offset minus the end of the token before
+ *   splices  bytes of backslash-newline inside the token
+ *   ids      lexeme id; the next unused id adds the next of `strings`
+ *   strings  (length varint, chars) per lexeme seen for the first time
+ *
+ * offsets and lengths are in bytes of the input, backslash-newlines inside
+ * the token included; lexemes are without them, as lex prints them, and
+ * one id is shared by every token with the same chars, from block to block
+ * varints are 7 bits a byte, low first, the high bit set on all but the last
+ * */
+
+#define TOKSTREAM_MAGIC "lextok01"
+#define TOKSTREAM_BLOCK 0x10000
+#define TOKSTREAM_COLUMNS 6
+
+static inline unsigned char* tokstream_put(unsigned char* p, uint64_t v) {
+  while (v >= 0x80) {
+    *p++ = v | 0x80;
+    v >>= 7;
+  }
+  *p++ = v;
+  return p;
+}
+
+/*
+ * read a varint at `*p` into `*v`, return -1 if it runs past `end`
+ * */
+static inline int tokstream_get(const unsigned char** p, const unsigned char* end, uint64_t* v) {
+
+  *v = 0;
+
+  for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+    unsigned char b = *(*p)++;
+    *v |= (uint64_t)(b & 0x7f) << shift;
+    if (b < 0x80) {
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+/*
+ * a decoded token; `s` lives until the stream is closed
+ * */
+struct Token {
+  int type;
+  int line;
+  uint64_t offset;
+  uint32_t len;
+  const char* s;
+  uint32_t s_len;
+};
+
+/*
+ * the decoder: the block being read, a cursor per column and the lexemes
+ * */
+struct TokStream {
+  FILE* fp;
+  unsigned char* raw;
+  uint64_t raw_cap;
+  unsigned char* packed;
+  uint64_t packed_cap;
+  const unsigned char* col[TOKSTREAM_COLUMNS];
+  const unsigned char* col_end[TOKSTREAM_COLUMNS];
+  uint64_t left;         // tokens left in the block
+  int type;
+  uint64_t run;          // tokens left of type `type`
+  int line;
+  uint64_t end;
+  char** lexeme;
+  uint32_t* lexeme_len;
+  uint64_t n_lexemes;
+  uint64_t cap_lexemes;
+  int done;
+  int error;
+};
+
+/*
+ * return -1 if `path` cannot be opened or is not a token stream
+ * */
+static inline int tokstream_open(struct TokStream* ts, const char* path) {
+
+  char magic[8];
+
+  memset(ts, 0, sizeof(*ts));
+  ts->fp = fopen(path, "rb");
+  if (ts->fp == NULL) {
+    return -1;
+  }
+  if (fread(magic, 1, sizeof(magic), ts->fp) != sizeof(magic) || memcmp(magic, TOKSTREAM_MAGIC, 8) != 0) {
+    fclose(ts->fp);
+    return -1;
+  }
+
+  return 0;
+}
+
+static inline int tokstream_read_varint(FILE* fp, uint64_t* v) {
+
+  *v = 0;
+
+  for (int shift = 0; shift < 64; shift += 7) {
+    int b = getc(fp);
+    if (b == EOF) {
+      return -1;
+    }
+    *v |= (uint64_t)(b & 0x7f) << shift;
+    if (b < 0x80) {
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+/*
+ * read and inflate the next block, return 0 after the last
+ * */
+static inline int tokstream_block(struct TokStream* ts) {
+
+  uint64_t n, raw_len, packed_len;
+
+  if (ts->done) {
+    return 0;
+  }
+  // a stream ends with a block of no tokens, not just anywhere
+  if (tokstream_read_varint(ts->fp, &n) != 0) {
+    ts->error = 1;
+    return 0;
+  }
+  if (n == 0) {
+    ts->done = 1;
+    return 0;
+  }
+  if (tokstream_read_varint(ts->fp, &raw_len) != 0 || tokstream_read_varint(ts->fp, &packed_len) != 0) {
+    ts->error = 1;
+    return 0;
+  }
+
+  if (raw_len > ts->raw_cap) {
+    ts->raw_cap = raw_len;
+    ts->raw = (unsigned char*)realloc(ts->raw, raw_len);
+  }
+  if (packed_len > ts->packed_cap) {
+    ts->packed_cap = packed_len;
+    ts->packed = (unsigned char*)realloc(ts->packed, packed_len);
+  }
+
+  uLongf got = raw_len;
+  if (fread(ts->packed, 1, packed_len, ts->fp) != packed_len
+      || uncompress(ts->raw, &got, ts->packed, packed_len) != Z_OK || got != raw_len) {
+    ts->error = 1;
+    return 0;
+  }
+
+  const unsigned char* p = ts->raw;
+  const unsigned char* end = ts->raw + raw_len;
+  for (int i = 0; i < TOKSTREAM_COLUMNS; i++) {
+    uint64_t len;
+    if (tokstream_get(&p, end, &len) != 0 || len > (uint64_t)(end - p)) {
+      ts->error = 1;
+      return 0;
+    }
+    ts->col[i] = p;
+    ts->col_end[i] = p + len;
+    p += len;
+  }
+  ts->left = n;
+  ts->run = 0;
+
+  return 1;
+}
+
+/*
+ * decode the next token to `t`, return 0 after the last, or on bad data
+ * with `error` set
+ * */
+static inline int tokstream_next(struct TokStream* ts, struct Token* t) {
+
+  if (ts->left == 0 && !tokstream_block(ts)) {
+    return 0;
+  }
+  ts->left--;
+
+  uint64_t id, len, line, gap, splices;
+
+  if (ts->run == 0) {
+    if (ts->col[0] == ts->col_end[0]) {
+      ts->error = 1;
+      return 0;
+    }
+    ts->type = *ts->col[0]++;
+    if (tokstream_get(&ts->col[0], ts->col_end[0], &ts->run) != 0 || ts->run == 0) {
+      ts->error = 1;
+      return 0;
+    }
+  }
+  ts->run--;
+
+  if (tokstream_get(&ts->col[4], ts->col_end[4], &id) != 0) {
+    ts->error = 1;
+    return 0;
+  }
+
+  if (id == ts->n_lexemes) {
+    if (tokstream_get(&ts->col[5], ts->col_end[5], &len) != 0
+        || len > (uint64_t)(ts->col_end[5] - ts->col[5])) {
+      ts->error = 1;
+      return 0;
+    }
+
+    if (ts->n_lexemes == ts->cap_lexemes) {
+      ts->cap_lexemes = ts->cap_lexemes == 0 ? 0x1000 : 2 * ts->cap_lexemes;
+      ts->lexeme = (char**)realloc(ts->lexeme, ts->cap_lexemes * sizeof(char*));
+      ts->lexeme_len = (uint32_t*)realloc(ts->lexeme_len, ts->cap_lexemes * sizeof(uint32_t));
+    }
+    ts->lexeme[id] = (char*)malloc(len + 1);
+    memcpy(ts->lexeme[id], ts->col[5], len);
+    ts->lexeme[id][len] = '\0';
+    ts->lexeme_len[id] = len;
+    ts->col[5] += len;
+    ts->n_lexemes++;
+  }
+  else if (id > ts->n_lexemes) {
+    ts->error = 1;
+    return 0;
+  }
+
+  if (tokstream_get(&ts->col[1], ts->col_end[1], &line) != 0
+      || tokstream_get(&ts->col[2], ts->col_end[2], &gap) != 0
+      || tokstream_get(&ts->col[3], ts->col_end[3], &splices) != 0) {
+    ts->error = 1;
+    return 0;
+  }
+
+  t->type = ts->type;
+  ts->line += line;
+  t->line = ts->line;
+  t->offset = ts->end + gap;
+  t->s = ts->lexeme[id];
+  t->s_len = ts->lexeme_len[id];
+  t->len = t->s_len + splices;
+  ts->end = t->offset + t->len;
+
+  return 1;
+}
+
+static inline void tokstream_close(struct TokStream* ts) {
+  for (uint64_t i = 0; i < ts->n_lexemes; i++) {
+    free(ts->lexeme[i]);
+  }
+  free(ts->lexeme);
+  free(ts->lexeme_len);
+  free(ts->raw);
+  free(ts->packed);
+  fclose(ts->fp);
+}